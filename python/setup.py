@@ -0,0 +1,32 @@
+# Python bindings for XenTrace binary data parser - Copyright (C) 2021
+# Giuseppe Eletto <peppe.eletto@gmail.com>
+# Dario Faggioli  <dfaggioli@suse.com>
+#
+# This library is released under the GNU Lesser General Public
+# License v2.1 (or later), see the LICENSE file.
+
+from glob import glob
+from os import path
+
+from setuptools import Extension, setup
+
+ROOT = path.relpath(path.join(path.dirname(__file__), '..'))
+SRCDIR = path.join(ROOT, 'src')
+LIBDIR = path.join(ROOT, 'lib')
+
+setup(
+    name='xentrace-parser',
+    version='0.1.0',
+    description='XenTrace binary data parser, events exported as zero-copy buffers',
+    license='LGPL-2.1-or-later',
+    python_requires='>=3.10',
+    ext_modules=[
+        Extension(
+            'xentrace_parser',
+            sources=['xentrace-parser-py.c'] + sorted(glob(path.join(SRCDIR, '*.c'))),
+            include_dirs=[SRCDIR, path.join(LIBDIR, 'xen')],
+            extra_compile_args=['-pthread'],
+            extra_link_args=['-pthread'],
+        ),
+    ],
+)
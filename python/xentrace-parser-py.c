@@ -0,0 +1,652 @@
+/**
+ * Python bindings for XenTrace binary data parser - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "xentrace-parser.h"
+
+/**
+ * Field descriptor, one per exported column.
+ * Offsets are taken from the C structs so that
+ * the buffers point straight into the event list.
+ */
+struct __field_d {
+    const char *name;    // Attribute name
+    const char *format;  // struct-module format
+    Py_ssize_t offset,   // Offset inside xt_event
+            itemsize,    // Size of a single item
+            columns;     // Items per event (0 for 1-D)
+};
+
+static const struct __field_d FIELDS[] = {
+    { "cpu",   "H", offsetof(xt_event, cpu),       sizeof(uint16_t), 0 },
+    { "dom",   "I", offsetof(xt_event, dom.u32),   sizeof(uint32_t), 0 },
+    { "vcpu",  "H", offsetof(xt_event, dom.vcpu),  sizeof(uint16_t), 0 },
+    { "domid", "H", offsetof(xt_event, dom.id),    sizeof(uint16_t), 0 },
+    { "tsc",   "Q", offsetof(xt_event, rec.tsc),   sizeof(uint64_t), 0 },
+    { "extra", "I", offsetof(xt_event, rec.extra), sizeof(uint32_t), XEN_REC_XTRS },
+    { NULL }
+};
+
+/**
+ * Decoded column descriptor, for the "rec" bit-fields
+ * that cannot be exported in place.
+ */
+struct __decoded_d {
+    const char *name;     // Attribute name
+    const char *format;   // struct-module format
+    Py_ssize_t itemsize;  // Size of a single item
+};
+
+#define DECODED_ID      0
+#define DECODED_N_EXTRA 1
+#define DECODED_IN_TSC  2
+#define DECODED_COUNT   3
+
+static const struct __decoded_d DECODED[] = {
+    [DECODED_ID]      = { "id",      "I", sizeof(uint32_t) },
+    [DECODED_N_EXTRA] = { "n_extra", "B", sizeof(uint8_t)  },
+    [DECODED_IN_TSC]  = { "in_tsc",  "B", sizeof(uint8_t)  },
+};
+
+/**
+ * Parser object.
+ */
+typedef struct {
+    PyObject_HEAD
+    xentrace_parser xtp;  // Wrapped instance
+    xt_event *events;     // First event (NULL if empty)
+    uint32_t count;       // Events count
+    int executed;         // xtp_execute() done?
+    void *decoded[ DECODED_COUNT ];  // Cached decoded columns
+    PyThread_type_lock lock;         // Held while executing or decoding
+} ParserObject;
+
+/**
+ * Buffer object, exports a (possibly strided)
+ * column of the event list or an owned array.
+ */
+typedef struct {
+    PyObject_HEAD
+    PyObject *owner;      // Keeps the event list alive
+    void *owned;          // Memory freed with the buffer (if any)
+    char *base;           // First item
+    const char *format;   // struct-module format
+    int ndim;             // 1 or 2
+    Py_ssize_t itemsize,
+            shape[2],
+            strides[2];
+} BufferObject;
+
+/**
+ * View object, a contiguous range of events.
+ */
+typedef struct {
+    PyObject_HEAD
+    ParserObject *parser;  // Parent parser
+    uint32_t start,        // First position
+            count;         // Events count
+} ViewObject;
+
+static PyTypeObject ParserType;
+static PyTypeObject BufferType;
+static PyTypeObject ViewType;
+
+/**
+ *
+ */
+static PyObject *new_buffer(PyObject *owner, void *owned, char *base, const char *format,
+                            Py_ssize_t itemsize, Py_ssize_t count, Py_ssize_t stride,
+                            Py_ssize_t columns) {
+    BufferObject *buf = PyObject_New(BufferObject, &BufferType);
+    if (!buf) {
+        free(owned);
+        return NULL;
+    }
+
+    Py_XINCREF(owner);
+    buf->owner    = owner;
+    buf->owned    = owned;
+    buf->base     = base;
+    buf->format   = format;
+    buf->itemsize = itemsize;
+    buf->ndim     = columns ? 2 : 1;
+
+    buf->shape[0]   = count;
+    buf->strides[0] = stride;
+    buf->shape[1]   = columns;
+    buf->strides[1] = itemsize;
+
+    return (PyObject *) buf;
+}
+
+/**
+ *
+ */
+static int Buffer_getbuffer(BufferObject *self, Py_buffer *view, int flags) {
+    if (flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "event buffers are read-only");
+        view->obj = NULL;
+        return -1;
+    }
+
+    // Empty buffers still need a valid pointer
+    static char empty;
+
+    view->buf        = self->base ? self->base : &empty;
+    view->obj        = (PyObject *) self;
+    view->len        = self->shape[0] * (self->ndim > 1 ? self->shape[1] : 1) * self->itemsize;
+    view->readonly   = 1;
+    view->itemsize   = self->itemsize;
+    view->format     = (flags & PyBUF_FORMAT) ? (char *) self->format : NULL;
+    view->ndim       = self->ndim;
+    view->shape      = self->shape;
+    view->strides    = self->strides;
+    view->suboffsets = NULL;
+    view->internal   = NULL;
+
+    // Consumers asking for contiguous memory
+    // must not receive a strided column
+    int contiguous = self->strides[0] == self->itemsize * (self->ndim > 1 ? self->shape[1] : 1);
+    if (!contiguous && !(flags & PyBUF_STRIDES)) {
+        PyErr_SetString(PyExc_BufferError, "event column is strided, request a strided buffer");
+        view->obj = NULL;
+        return -1;
+    }
+
+    Py_INCREF(self);
+    return 0;
+}
+
+/**
+ *
+ */
+static void Buffer_dealloc(BufferObject *self) {
+    Py_XDECREF(self->owner);
+    free(self->owned);
+    PyObject_Free(self);
+}
+
+/**
+ *
+ */
+static Py_ssize_t Buffer_length(BufferObject *self) {
+    return self->shape[0];
+}
+
+static PyBufferProcs Buffer_as_buffer = {
+    .bf_getbuffer = (getbufferproc) Buffer_getbuffer,
+};
+
+static PySequenceMethods Buffer_as_sequence = {
+    .sq_length = (lenfunc) Buffer_length,
+};
+
+static PyTypeObject BufferType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "xentrace_parser.Buffer",
+    .tp_doc = "Read-only event column, exported through the buffer protocol.",
+    .tp_basicsize = sizeof(BufferObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) Buffer_dealloc,
+    .tp_as_buffer = &Buffer_as_buffer,
+    .tp_as_sequence = &Buffer_as_sequence,
+};
+
+/**
+ * Returns the first position with a TSC not lower than "tsc".
+ */
+static uint32_t lower_bound(const xt_event *events, uint32_t count, uint64_t tsc) {
+    uint32_t low = 0, high = count;
+
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if ((events[mid].rec).tsc < tsc)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/**
+ *
+ */
+static int check_executed(ParserObject *parser) {
+    if (!parser->executed) {
+        PyErr_SetString(PyExc_RuntimeError, "execute() has not been called");
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ *
+ */
+static PyObject *new_view(ParserObject *parser, uint32_t start, uint32_t count) {
+    ViewObject *view = PyObject_New(ViewObject, &ViewType);
+    if (!view)
+        return NULL;
+
+    Py_INCREF(parser);
+    view->parser = parser;
+    view->start  = start;
+    view->count  = count;
+
+    return (PyObject *) view;
+}
+
+/**
+ *
+ */
+static PyObject *View_field(ViewObject *self, void *closure) {
+    const struct __field_d *field = closure;
+    ParserObject *parser = self->parser;
+
+    char *base = parser->events
+        ? (char *) (parser->events + self->start) + field->offset
+        : NULL;
+
+    return new_buffer((PyObject *) parser, NULL, base, field->format, field->itemsize,
+                      self->count, sizeof(xt_event), field->columns);
+}
+
+/**
+ * Acquires the parser lock, waiting
+ * for it without holding the GIL.
+ */
+static void lock_parser(ParserObject *parser) {
+    if (PyThread_acquire_lock(parser->lock, NOWAIT_LOCK))
+        return;
+
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(parser->lock, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+}
+
+/**
+ *
+ */
+static void decode_column(int column, const xt_event *events, uint32_t count, void *out) {
+    for (uint32_t i = 0; i < count; ++i) {
+        const xt_record *rec = &events[i].rec;
+
+        switch (column) {
+            case DECODED_ID:
+                ((uint32_t *) out)[i] = rec->id;
+                break;
+            case DECODED_N_EXTRA:
+                ((uint8_t *) out)[i] = rec->n_extra;
+                break;
+            case DECODED_IN_TSC:
+                ((uint8_t *) out)[i] = rec->in_tsc;
+                break;
+        }
+    }
+}
+
+/**
+ *
+ */
+static PyObject *View_decoded(ViewObject *self, void *closure) {
+    const struct __decoded_d *field = closure;
+    ParserObject *parser = self->parser;
+    int column = field - DECODED;
+
+    // Decode the column once and share it (under
+    // the lock, so that only one thread does it)
+    if (!parser->decoded[column] && parser->count) {
+        lock_parser(parser);
+
+        if (!parser->decoded[column]) {
+            void *out = malloc(field->itemsize * parser->count);
+            if (!out) {
+                PyThread_release_lock(parser->lock);
+                return PyErr_NoMemory();
+            }
+
+            Py_BEGIN_ALLOW_THREADS
+            decode_column(column, parser->events, parser->count, out);
+            Py_END_ALLOW_THREADS
+
+            parser->decoded[column] = out;
+        }
+
+        PyThread_release_lock(parser->lock);
+    }
+
+    char *base = parser->decoded[column]
+        ? (char *) parser->decoded[column] + field->itemsize * self->start
+        : NULL;
+
+    return new_buffer((PyObject *) parser, NULL, base, field->format, field->itemsize,
+                      self->count, field->itemsize, 0);
+}
+
+/**
+ *
+ */
+static PyObject *View_range(ViewObject *self, PyObject *args) {
+    unsigned long long tsc_from, tsc_to;
+    if (!PyArg_ParseTuple(args, "KK", &tsc_from, &tsc_to))
+        return NULL;
+
+    // Events are sorted by TSC, so a time range
+    // is always a contiguous slice of the list
+    const xt_event *events = self->parser->events + self->start;
+    uint32_t from = 0, to = 0;
+
+    if (events && tsc_from < tsc_to) {
+        from = lower_bound(events, self->count, tsc_from);
+        to   = lower_bound(events, self->count, tsc_to);
+    }
+
+    return new_view(self->parser, self->start + from, to - from);
+}
+
+/**
+ *
+ */
+static PyObject *View_select(ViewObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = { "id", "mask", "cpu", "domid", NULL };
+    long id = -1, mask = 0x0fffffff, cpu = -1, domid = -1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|llll", kwlist, &id, &mask, &cpu, &domid))
+        return NULL;
+
+    const xt_event *events = self->parser->events + self->start;
+    uint32_t count = self->count, found = 0;
+
+    uint32_t *pos = malloc(sizeof(*pos) * (count ? count : 1));
+    if (!pos)
+        return PyErr_NoMemory();
+
+    // Positions are relative to the view, so they
+    // can index any of its columns directly
+    Py_BEGIN_ALLOW_THREADS
+    for (uint32_t i = 0; i < count; ++i) {
+        const xt_event *event = events + i;
+
+        if (id >= 0 && ((event->rec).id & mask) != (uint32_t) id)
+            continue;
+        if (cpu >= 0 && event->cpu != cpu)
+            continue;
+        if (domid >= 0 && (event->dom).id != domid)
+            continue;
+
+        pos[found++] = i;
+    }
+    Py_END_ALLOW_THREADS
+
+    uint32_t *shrunk = realloc(pos, sizeof(*pos) * (found ? found : 1));
+    if (shrunk)
+        pos = shrunk;
+
+    return new_buffer(NULL, pos, (char *) pos, "I", sizeof(uint32_t), found, sizeof(uint32_t), 0);
+}
+
+/**
+ *
+ */
+static Py_ssize_t View_length(ViewObject *self) {
+    return self->count;
+}
+
+/**
+ *
+ */
+static void View_dealloc(ViewObject *self) {
+    Py_DECREF(self->parser);
+    PyObject_Free(self);
+}
+
+static PyGetSetDef View_getset[] = {
+    { "cpu",     (getter) View_field,   NULL, "Host CPU column (uint16).",                 (void *) &FIELDS[0] },
+    { "dom",     (getter) View_field,   NULL, "Raw domain/vCPU column (uint32).",          (void *) &FIELDS[1] },
+    { "vcpu",    (getter) View_field,   NULL, "vCPU column (uint16).",                     (void *) &FIELDS[2] },
+    { "domid",   (getter) View_field,   NULL, "Domain column (uint16).",                   (void *) &FIELDS[3] },
+    { "tsc",     (getter) View_field,   NULL, "TSC column (uint64).",                      (void *) &FIELDS[4] },
+    { "extra",   (getter) View_field,   NULL, "Extra[] columns (uint32, N x 7), zero past n_extra.", (void *) &FIELDS[5] },
+    { "id",      (getter) View_decoded, NULL, "Event identifier column (uint32).",         (void *) &DECODED[DECODED_ID] },
+    { "n_extra", (getter) View_decoded, NULL, "Valid extra[] items column (uint8).",       (void *) &DECODED[DECODED_N_EXTRA] },
+    { "in_tsc",  (getter) View_decoded, NULL, "Record includes TSC column (uint8).",       (void *) &DECODED[DECODED_IN_TSC] },
+    { NULL }
+};
+
+static PyMethodDef View_methods[] = {
+    { "range", (PyCFunction) View_range, METH_VARARGS,
+      "range(tsc_from, tsc_to) -> View of the events with tsc_from <= TSC < tsc_to." },
+    { "select", (PyCFunction) View_select, METH_VARARGS | METH_KEYWORDS,
+      "select(id=-1, mask=0x0fffffff, cpu=-1, domid=-1) -> Buffer of matching positions (uint32)." },
+    { NULL }
+};
+
+static PySequenceMethods View_as_sequence = {
+    .sq_length = (lenfunc) View_length,
+};
+
+static PyTypeObject ViewType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "xentrace_parser.View",
+    .tp_doc = "Contiguous range of events sorted by TSC.",
+    .tp_basicsize = sizeof(ViewObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) View_dealloc,
+    .tp_getset = View_getset,
+    .tp_methods = View_methods,
+    .tp_as_sequence = &View_as_sequence,
+};
+
+/**
+ *
+ */
+static int Parser_init(ParserObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = { "file", NULL };
+    PyObject *path;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", kwlist, PyUnicode_FSConverter, &path))
+        return -1;
+
+    if (self->xtp) {
+        Py_DECREF(path);
+        PyErr_SetString(PyExc_RuntimeError, "parser already initialized");
+        return -1;
+    }
+
+    if (!self->lock)
+        self->lock = PyThread_allocate_lock();
+    if (!self->lock) {
+        Py_DECREF(path);
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    self->xtp = xtp_init(PyBytes_AS_STRING(path));
+    if (!self->xtp) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        Py_DECREF(path);
+        return -1;
+    }
+
+    Py_DECREF(path);
+    return 0;
+}
+
+/**
+ *
+ */
+static PyObject *Parser_execute(ParserObject *self, PyObject *Py_UNUSED(ignored)) {
+    if (!self->xtp) {
+        PyErr_SetString(PyExc_RuntimeError, "parser not initialized");
+        return NULL;
+    }
+
+    if (!self->executed) {
+        // The instance is not thread-safe, only
+        // one thread at a time can parse the trace
+        if (!PyThread_acquire_lock(self->lock, NOWAIT_LOCK)) {
+            PyErr_SetString(PyExc_RuntimeError, "execute() is already running in another thread");
+            return NULL;
+        }
+
+        uint32_t count;
+
+        Py_BEGIN_ALLOW_THREADS
+        count = xtp_execute(self->xtp);
+        Py_END_ALLOW_THREADS
+
+        self->executed = 1;
+        self->count    = count;
+        self->events   = xtp_get_event(self->xtp, 0);
+        PyThread_release_lock(self->lock);
+    }
+
+    return PyLong_FromUnsignedLong(self->count);
+}
+
+/**
+ *
+ */
+static PyObject *Parser_view(ParserObject *self, PyObject *Py_UNUSED(ignored)) {
+    if (!check_executed(self))
+        return NULL;
+
+    return new_view(self, 0, self->count);
+}
+
+/**
+ *
+ */
+static PyObject *Parser_range(ParserObject *self, PyObject *args) {
+    if (!check_executed(self))
+        return NULL;
+
+    ViewObject *whole = (ViewObject *) new_view(self, 0, self->count);
+    if (!whole)
+        return NULL;
+
+    PyObject *view = View_range(whole, args);
+    Py_DECREF(whole);
+    return view;
+}
+
+/**
+ *
+ */
+static PyObject *Parser_cpus_count(ParserObject *self, void *closure) {
+    if (!check_executed(self))
+        return NULL;
+
+    return PyLong_FromUnsignedLong(xtp_cpus_count(self->xtp));
+}
+
+/**
+ *
+ */
+static Py_ssize_t Parser_length(ParserObject *self) {
+    return self->count;
+}
+
+/**
+ *
+ */
+static void Parser_dealloc(ParserObject *self) {
+    if (self->xtp)
+        xtp_free(self->xtp);
+
+    if (self->lock)
+        PyThread_free_lock(self->lock);
+
+    for (int i = 0; i < DECODED_COUNT; ++i)
+        free(self->decoded[i]);
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyGetSetDef Parser_getset[] = {
+    { "cpus_count", (getter) Parser_cpus_count, NULL, "Host CPUs count of the trace.", NULL },
+    { NULL }
+};
+
+static PyMethodDef Parser_methods[] = {
+    { "execute", (PyCFunction) Parser_execute, METH_NOARGS,
+      "execute() -> Parses the trace (without holding the GIL), returns the events count." },
+    { "view", (PyCFunction) Parser_view, METH_NOARGS,
+      "view() -> View of all the events." },
+    { "range", (PyCFunction) Parser_range, METH_VARARGS,
+      "range(tsc_from, tsc_to) -> View of the events with tsc_from <= TSC < tsc_to." },
+    { NULL }
+};
+
+static PySequenceMethods Parser_as_sequence = {
+    .sq_length = (lenfunc) Parser_length,
+};
+
+static PyTypeObject ParserType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "xentrace_parser.Parser",
+    .tp_doc = "Parser(file) -> XenTrace binary data parser.",
+    .tp_basicsize = sizeof(ParserObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc) Parser_init,
+    .tp_dealloc = (destructor) Parser_dealloc,
+    .tp_getset = Parser_getset,
+    .tp_methods = Parser_methods,
+    .tp_as_sequence = &Parser_as_sequence,
+};
+
+static struct PyModuleDef xentrace_parser_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "xentrace_parser",
+    .m_doc = "XenTrace binary data parser, events exported as zero-copy buffers.",
+    .m_size = -1,
+};
+
+/**
+ *
+ */
+PyMODINIT_FUNC PyInit_xentrace_parser(void) {
+    if (PyType_Ready(&ParserType) < 0 || PyType_Ready(&ViewType) < 0
+            || PyType_Ready(&BufferType) < 0)
+        return NULL;
+
+    PyObject *module = PyModule_Create(&xentrace_parser_module);
+    if (!module)
+        return NULL;
+
+    if (PyModule_AddObjectRef(module, "Parser", (PyObject *) &ParserType) < 0
+            || PyModule_AddObjectRef(module, "View", (PyObject *) &ViewType) < 0
+            || PyModule_AddObjectRef(module, "Buffer", (PyObject *) &BufferType) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
+}
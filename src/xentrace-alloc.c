@@ -0,0 +1,310 @@
+/**
+ * Allocators for XenTrace binary data parser - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "xentrace-alloc.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_MIN_CHUNK (64 * 1024)
+#define ARENA_BIG_BLOCK (64 * 1024)    // Served by a dedicated mapping
+#define ARENA_HUGE_BLOCK (2048 * 1024) // Worth transparent huge pages
+#define ARR_BLOCKS_SSIZE 8
+
+/**
+ *
+ */
+static void *libc_alloc(void *ctx, size_t size) {
+    return malloc(size);
+}
+
+/**
+ *
+ */
+static void *libc_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    return realloc(ptr, new_size);
+}
+
+/**
+ *
+ */
+static void libc_free(void *ctx, void *ptr, size_t size) {
+    free(ptr);
+}
+
+const xt_allocator xt_libc_allocator = {
+    .alloc   = libc_alloc,
+    .realloc = libc_realloc,
+    .free    = libc_free,
+    .ctx     = NULL,
+};
+
+/**
+ * Arena chunk, small blocks are
+ * bumped one after another.
+ */
+struct __chunk {
+    struct __chunk *next;  // Previous (full) chunk
+    size_t size,           // Payload size
+            used,          // Used bytes
+            last;          // Offset of the last block
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+/**
+ * Arena instance.
+ */
+struct __arena {
+    struct __chunk *chunk;  // Current chunk
+    size_t chunk_size;      // Default chunk size
+
+    // Big blocks (dedicated mappings)
+    struct __block_l {
+        struct __block {
+            void *ptr;    // Mapping address
+            size_t size;  // Mapping size
+        } *ptr;
+        uint32_t length,  // Array length
+                count;    // Elements count
+    } block_l;
+};
+
+/**
+ *
+ */
+static size_t align_size(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+/**
+ *
+ */
+static void advise_huge(void *ptr, size_t size) {
+#ifdef MADV_HUGEPAGE
+    if (size >= ARENA_HUGE_BLOCK)
+        madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+}
+
+/**
+ *
+ */
+static struct __block *find_block(struct __arena *arena, void *ptr) {
+    struct __block_l *block_l = &arena->block_l;
+
+    // Most recent first, it is usually the one growing
+    for (uint32_t i = block_l->count; i-- > 0;)
+        if ((block_l->ptr[i]).ptr == ptr)
+            return block_l->ptr + i;
+
+    return NULL;
+}
+
+/**
+ *
+ */
+static void *alloc_block(struct __arena *arena, size_t size) {
+    struct __block_l *block_l = &arena->block_l;
+
+    // Expand block list (if needed)
+    if (block_l->count == block_l->length) {
+        uint32_t new_length = block_l->length ? block_l->length * 2 : ARR_BLOCKS_SSIZE;
+        struct __block *new_ptr = realloc(block_l->ptr, sizeof(*new_ptr) * new_length);
+        if (!new_ptr)
+            return NULL;
+
+        block_l->length = new_length;
+        block_l->ptr = new_ptr;
+    }
+
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+
+    advise_huge(ptr, size);
+
+    struct __block *block = block_l->ptr + block_l->count++;
+    block->ptr  = ptr;
+    block->size = size;
+    return ptr;
+}
+
+/**
+ *
+ */
+static void free_block(struct __arena *arena, struct __block *block) {
+    struct __block_l *block_l = &arena->block_l;
+
+    munmap(block->ptr, block->size);
+    *block = block_l->ptr[ --block_l->count ];
+}
+
+/**
+ *
+ */
+static int is_last(const struct __chunk *chunk, const void *ptr) {
+    return chunk && ptr == chunk->data + chunk->last;
+}
+
+/**
+ *
+ */
+static void *arena_alloc(void *ctx, size_t size) {
+    struct __arena *arena = ctx;
+
+    if (size >= ARENA_BIG_BLOCK)
+        return alloc_block(arena, size);
+
+    size = align_size(size ? size : 1);
+
+    // Start a new chunk (if needed)
+    struct __chunk *chunk = arena->chunk;
+    if (!chunk || chunk->used + size > chunk->size) {
+        size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+
+        struct __chunk *new_chunk = malloc(sizeof(*new_chunk) + chunk_size);
+        if (!new_chunk)
+            return NULL;
+
+        new_chunk->next = chunk;
+        new_chunk->size = chunk_size;
+        new_chunk->used = 0;
+        new_chunk->last = 0;
+        arena->chunk = chunk = new_chunk;
+    }
+
+    // Bump
+    chunk->last = chunk->used;
+    chunk->used += size;
+    return chunk->data + chunk->last;
+}
+
+/**
+ *
+ */
+static void *arena_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    struct __arena *arena = ctx;
+    struct __chunk *chunk = arena->chunk;
+
+    // Big blocks are remapped
+    struct __block *block = find_block(arena, ptr);
+    if (block) {
+        size_t size = new_size ? new_size : 1;
+        void *new_ptr = mremap(block->ptr, block->size, size, MREMAP_MAYMOVE);
+        if (new_ptr == MAP_FAILED)
+            return NULL;
+
+        advise_huge(new_ptr, size);
+        block->ptr  = new_ptr;
+        block->size = size;
+        return new_ptr;
+    }
+
+    // The last block of the chunk can grow in place
+    if (is_last(chunk, ptr) && new_size < ARENA_BIG_BLOCK
+            && chunk->last + align_size(new_size) <= chunk->size) {
+        chunk->used = chunk->last + align_size(new_size ? new_size : 1);
+        return ptr;
+    }
+
+    // Otherwise move it
+    void *new_ptr = arena_alloc(arena, new_size);
+    if (!new_ptr)
+        return NULL;
+
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+
+    // Give the old block back, if nothing was bumped after it
+    if (is_last(chunk, ptr))
+        chunk->used = chunk->last;
+
+    return new_ptr;
+}
+
+/**
+ *
+ */
+static void arena_free_ptr(void *ctx, void *ptr, size_t size) {
+    struct __arena *arena = ctx;
+
+    struct __block *block = find_block(arena, ptr);
+    if (block) {
+        free_block(arena, block);
+        return;
+    }
+
+    // Roll back the last bump, other
+    // blocks go away with the arena
+    struct __chunk *chunk = arena->chunk;
+    if (is_last(chunk, ptr))
+        chunk->used = chunk->last;
+}
+
+/**
+ *
+ */
+struct __arena *arena_new(size_t chunk_size) {
+    struct __arena *arena = calloc(1, sizeof(*arena));
+    if (!arena)
+        return NULL;
+
+    arena->chunk_size = align_size(chunk_size > ARENA_MIN_CHUNK ? chunk_size : ARENA_MIN_CHUNK);
+    return arena;
+}
+
+/**
+ *
+ */
+xt_allocator arena_allocator(struct __arena *arena) {
+    return (xt_allocator) {
+        .alloc   = arena_alloc,
+        .realloc = arena_realloc,
+        .free    = arena_free_ptr,
+        .ctx     = arena,
+    };
+}
+
+/**
+ *
+ */
+void arena_free(struct __arena *arena) {
+    if (!arena)
+        return;
+
+    struct __block_l *block_l = &arena->block_l;
+    for (uint32_t i = 0; i < block_l->count; ++i)
+        munmap((block_l->ptr[i]).ptr, (block_l->ptr[i]).size);
+
+    struct __chunk *chunk = arena->chunk;
+    while (chunk) {
+        struct __chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(block_l->ptr);
+    free(arena);
+}
@@ -0,0 +1,93 @@
+/**
+ * Allocators for XenTrace binary data parser - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef __XTALLOC_H
+#define __XTALLOC_H
+
+#include <stddef.h>
+#include <string.h>
+
+#include "xentrace-parser.h"
+
+/**
+ * Allocator based on malloc/realloc/free.
+ */
+extern const xt_allocator xt_libc_allocator;
+
+/**
+ * Bump/arena allocator (internal).
+ */
+struct __arena;
+
+/**
+ * Create a new arena, whose chunks are
+ * at least X bytes large.
+ * Returns NULL on error.
+ */
+struct __arena *arena_new(size_t);
+
+/**
+ * Returns an allocator backed by an arena.
+ */
+xt_allocator arena_allocator(struct __arena *);
+
+/**
+ * Frees up an arena and all its allocations.
+ */
+void arena_free(struct __arena *);
+
+/**
+ *
+ */
+static inline void *xt_alloc(const xt_allocator *alloc, size_t size) {
+    return alloc->alloc(alloc->ctx, size);
+}
+
+/**
+ *
+ */
+static inline void *xt_zalloc(const xt_allocator *alloc, size_t size) {
+    void *ptr = alloc->alloc(alloc->ctx, size);
+    if (ptr)
+        memset(ptr, 0, size);
+
+    return ptr;
+}
+
+/**
+ *
+ */
+static inline void *xt_realloc(const xt_allocator *alloc, void *ptr, size_t old_size, size_t new_size) {
+    if (!ptr)
+        return alloc->alloc(alloc->ctx, new_size);
+
+    return alloc->realloc(alloc->ctx, ptr, old_size, new_size);
+}
+
+/**
+ *
+ */
+static inline void xt_free(const xt_allocator *alloc, void *ptr, size_t size) {
+    if (ptr)
+        alloc->free(alloc->ctx, ptr, size);
+}
+
+#endif
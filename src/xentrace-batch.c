@@ -0,0 +1,510 @@
+/**
+ * Batch parser for XenTrace binary data - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "xentrace-parser.h"
+#include "xentrace-internal.h"
+
+#define BATCH_RECORD_SIZE 12  // Header + TSC, the usual record
+#define BATCH_MIN_EVENTS 4096
+
+/**
+ * Per worker trace queue.
+ * The owner pops from the head,
+ * thieves steal from the tail.
+ */
+struct __deque {
+    pthread_mutex_t lock;
+    uint32_t *items,  // Trace indexes
+            head,     // First item
+            tail;     // Past the last item
+};
+
+/**
+ * Worker thread.
+ */
+struct __worker {
+    struct __xentrace_batch *batch;
+    pthread_t thread;
+    uint16_t id;
+    struct __deque deque;
+
+    // Event list kept between traces
+    struct __cache {
+        xt_event *ptr;    // Array pointer
+        uint32_t length;  // Array length
+        uint64_t held,    // Bytes accounted to the cap
+                reserved, // Bytes reserved for the current trace
+                used;     // Bytes allocated by the current trace
+    } cache;
+
+    // Allocator of the instances,
+    // charging the memory cap
+    xt_allocator alloc;
+};
+
+/**
+ * XenTrace batch instance.
+ */
+struct __xentrace_batch {
+    uint16_t threads;           // Workers count
+    struct __worker *workers;   // Workers array
+
+    pthread_mutex_t lock;
+    pthread_cond_t start,       // New run or shutdown
+            done,               // All workers idle
+            memory;             // Memory released
+
+    // Run related vars
+    struct __run {
+        const char *const *paths;  // Trace paths
+        uint64_t *estimate;        // Estimated bytes per trace
+        xtp_batch_cb callback;     // User callback
+        void *ctx;                 // User context
+        uint32_t generation,       // Run counter
+                parsed;            // Successfully parsed traces
+        uint16_t active;           // Workers still running
+        uint8_t shutdown;          // Workers must exit?
+    } run;
+
+    // Memory cap related vars
+    struct __mem {
+        uint64_t cap,       // Global cap (bytes)
+                reserved;   // Reserved + cached bytes
+        uint16_t in_flight; // Traces being parsed
+    } mem;
+};
+
+/**
+ *
+ */
+static int deque_pop(struct __deque *deque, uint32_t *item) {
+    pthread_mutex_lock(&deque->lock);
+
+    int found = deque->head < deque->tail;
+    if (found)
+        *item = deque->items[deque->head++];
+
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/**
+ *
+ */
+static int deque_steal(struct __deque *deque, uint32_t *item) {
+    pthread_mutex_lock(&deque->lock);
+
+    int found = deque->head < deque->tail;
+    if (found)
+        *item = deque->items[--deque->tail];
+
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/**
+ *
+ */
+static int next_trace(struct __worker *worker, uint32_t *item) {
+    struct __xentrace_batch *batch = worker->batch;
+
+    if (deque_pop(&worker->deque, item))
+        return 1;
+
+    // Own queue is empty, steal from the others
+    for (uint16_t i = 1; i < batch->threads; ++i) {
+        struct __worker *victim = batch->workers + (worker->id + i) % batch->threads;
+        if (deque_steal(&victim->deque, item))
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ *
+ */
+static void drop_cache(struct __worker *worker) {
+    struct __cache *cache = &worker->cache;
+
+    (worker->batch->mem).reserved -= cache->held;
+    free(cache->ptr);
+
+    cache->ptr    = NULL;
+    cache->length = 0;
+    cache->held   = 0;
+}
+
+/**
+ * Waits until the trace fits into the memory cap.
+ * A trace is always allowed if nothing else is
+ * being parsed, or no progress would be possible.
+ */
+static void reserve_memory(struct __worker *worker, uint64_t estimate) {
+    struct __xentrace_batch *batch = worker->batch;
+    struct __cache *cache = &worker->cache;
+    struct __mem *mem = &batch->mem;
+
+    pthread_mutex_lock(&batch->lock);
+
+    uint64_t extra = estimate > cache->held ? estimate - cache->held : 0;
+    while (extra && mem->reserved + extra > mem->cap && mem->in_flight) {
+        // Give back idle memory before waiting
+        if (cache->ptr) {
+            drop_cache(worker);
+            extra = estimate;
+            continue;
+        }
+
+        pthread_cond_wait(&batch->memory, &batch->lock);
+    }
+
+    mem->reserved += extra;
+    mem->in_flight++;
+    cache->reserved = cache->held + extra;
+
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/**
+ *
+ */
+static void release_memory(struct __worker *worker, int parsed) {
+    struct __xentrace_batch *batch = worker->batch;
+    struct __cache *cache = &worker->cache;
+    struct __mem *mem = &batch->mem;
+
+    pthread_mutex_lock(&batch->lock);
+
+    // Account the real size of the kept list
+    uint64_t held = sizeof(*cache->ptr) * (uint64_t) cache->length;
+    mem->reserved = mem->reserved - cache->reserved + held;
+    cache->held = held;
+
+    if (mem->reserved > mem->cap)
+        drop_cache(worker);
+
+    mem->in_flight--;
+    (batch->run).parsed += parsed;
+
+    pthread_cond_broadcast(&batch->memory);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/**
+ * Accounts an allocation of the current trace.
+ * Memory past the reservation is charged to the
+ * cap at once (a trace in progress never waits),
+ * so that the next traces wait for it.
+ */
+static void charge_memory(struct __worker *worker, size_t old_size, size_t new_size) {
+    struct __cache *cache = &worker->cache;
+
+    cache->used = cache->used - old_size + new_size;
+    if (cache->used <= cache->reserved)
+        return;
+
+    struct __xentrace_batch *batch = worker->batch;
+    pthread_mutex_lock(&batch->lock);
+    (batch->mem).reserved += cache->used - cache->reserved;
+    cache->reserved = cache->used;
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/**
+ *
+ */
+static void *batch_alloc(void *ctx, size_t size) {
+    void *ptr = malloc(size);
+    if (ptr)
+        charge_memory(ctx, 0, size);
+
+    return ptr;
+}
+
+/**
+ *
+ */
+static void *batch_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    void *new_ptr = realloc(ptr, new_size);
+    if (new_ptr)
+        charge_memory(ctx, old_size, new_size);
+
+    return new_ptr;
+}
+
+/**
+ *
+ */
+static void batch_free(void *ctx, void *ptr, size_t size) {
+    free(ptr);
+    charge_memory(ctx, size, 0);
+}
+
+/**
+ *
+ */
+static void parse_trace(struct __worker *worker, uint32_t index) {
+    struct __run *run = &(worker->batch)->run;
+    struct __cache *cache = &worker->cache;
+    uint64_t estimate = run->estimate[index];
+
+    reserve_memory(worker, estimate);
+
+    // Grow the kept list up to the estimate,
+    // so that the parser rarely needs to expand it
+    uint64_t events = estimate / sizeof(*cache->ptr);
+    if (events < BATCH_MIN_EVENTS)
+        events = BATCH_MIN_EVENTS;
+
+    if (cache->length < events && events <= UINT32_MAX) {
+        xt_event *new_ptr = realloc(cache->ptr, sizeof(*cache->ptr) * events);
+        if (new_ptr) {
+            cache->ptr    = new_ptr;
+            cache->length = events;
+        }
+    }
+
+    // Account the list (it may have grown past
+    // a tiny estimate) and whatever the parser
+    // is going to allocate
+    cache->used = 0;
+    charge_memory(worker, 0, sizeof(*cache->ptr) * (uint64_t) cache->length);
+
+    // The parser adopts the list...
+    xentrace_parser xtp = xtp_init_events(run->paths[index], &worker->alloc,
+                                          cache->ptr, cache->length);
+    cache->ptr    = NULL;
+    cache->length = 0;
+
+    uint32_t count = xtp ? xtp_execute(xtp) : 0;
+    run->callback(xtp, index, run->ctx);
+
+    // ...and gives it back once done
+    if (xtp) {
+        cache->ptr = xtp_take_events(xtp, &cache->length);
+        xtp_free(xtp);
+    }
+
+    release_memory(worker, count > 0);
+}
+
+/**
+ *
+ */
+static void *worker_main(void *arg) {
+    struct __worker *worker = arg;
+    struct __xentrace_batch *batch = worker->batch;
+    struct __run *run = &batch->run;
+    uint32_t generation = 0;
+
+    pthread_mutex_lock(&batch->lock);
+    for (;;) {
+        // Wait for a new run
+        while (!run->shutdown && run->generation == generation)
+            pthread_cond_wait(&batch->start, &batch->lock);
+
+        if (run->shutdown)
+            break;
+
+        generation = run->generation;
+        pthread_mutex_unlock(&batch->lock);
+
+        uint32_t index;
+        while (next_trace(worker, &index))
+            parse_trace(worker, index);
+
+        pthread_mutex_lock(&batch->lock);
+        if (!--run->active)
+            pthread_cond_signal(&batch->done);
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    free((worker->cache).ptr);
+    return NULL;
+}
+
+/**
+ *
+ */
+xentrace_batch xtp_batch_init(uint16_t threads, uint64_t mem_cap) {
+    if (!threads) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 && online <= UINT16_MAX ? online : 1;
+    }
+
+    struct __xentrace_batch *batch = calloc(1, sizeof(*batch));
+    if (!batch)
+        return NULL;
+
+    batch->workers = calloc(threads, sizeof(*batch->workers));
+    if (!batch->workers) {
+        free(batch);
+        return NULL;
+    }
+
+    (batch->mem).cap = mem_cap ? mem_cap : UINT64_MAX;
+
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->start, NULL);
+    pthread_cond_init(&batch->done, NULL);
+    pthread_cond_init(&batch->memory, NULL);
+
+    // Start workers
+    for (uint16_t i = 0; i < threads; ++i) {
+        struct __worker *worker = batch->workers + i;
+        worker->batch = batch;
+        worker->id = i;
+        worker->alloc = (xt_allocator) {
+            .alloc   = batch_alloc,
+            .realloc = batch_realloc,
+            .free    = batch_free,
+            .ctx     = worker,
+        };
+        pthread_mutex_init(&(worker->deque).lock, NULL);
+
+        if (pthread_create(&worker->thread, NULL, worker_main, worker)) {
+            pthread_mutex_destroy(&(worker->deque).lock);
+            break;
+        }
+
+        batch->threads++;
+    }
+
+    if (!batch->threads) {
+        xtp_batch_free(batch);
+        return NULL;
+    }
+
+    return batch;
+}
+
+/**
+ *
+ */
+static int __qsort_cmpr(const void *a, const void *b) {
+    uint64_t x = ((uint64_t *) a)[0],
+            y  = ((uint64_t *) b)[0];
+
+    return (x < y) - (x > y);
+}
+
+/**
+ *
+ */
+uint32_t xtp_batch_run(xentrace_batch batch, const char *const *paths, uint32_t count,
+                       xtp_batch_cb callback, void *ctx) {
+    if (!count || !callback)
+        return 0;
+
+    struct __run *run = &batch->run;
+    uint64_t *estimate = malloc(sizeof(*estimate) * count);
+    uint64_t (*order)[2] = malloc(sizeof(*order) * count);
+
+    // Every worker gets a slice of "per_worker" items
+    uint32_t per_worker = (count + batch->threads - 1) / batch->threads;
+    uint32_t *items = malloc(sizeof(*items) * per_worker * batch->threads);
+
+    if (!estimate || !order || !items) {
+        free(estimate);
+        free(order);
+        free(items);
+        return 0;
+    }
+
+    // Estimate the event list size of every trace
+    for (uint32_t i = 0; i < count; ++i) {
+        struct stat st;
+        uint64_t size = stat(paths[i], &st) ? 0 : st.st_size;
+
+        estimate[i] = size / BATCH_RECORD_SIZE * sizeof(xt_event);
+        order[i][0] = estimate[i];
+        order[i][1] = i;
+    }
+
+    // Largest traces first, dealt round-robin
+    qsort(order, count, sizeof(*order), __qsort_cmpr);
+
+    for (uint16_t i = 0; i < batch->threads; ++i) {
+        struct __deque *deque = &(batch->workers[i]).deque;
+        deque->items = items + i * per_worker;
+        deque->head  = 0;
+        deque->tail  = 0;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        struct __deque *deque = &(batch->workers[i % batch->threads]).deque;
+        deque->items[deque->tail++] = order[i][1];
+    }
+
+    free(order);
+
+    // Start the run and wait for it
+    pthread_mutex_lock(&batch->lock);
+
+    run->paths    = paths;
+    run->estimate = estimate;
+    run->callback = callback;
+    run->ctx      = ctx;
+    run->parsed   = 0;
+    run->active   = batch->threads;
+    run->generation++;
+
+    pthread_cond_broadcast(&batch->start);
+    while (run->active)
+        pthread_cond_wait(&batch->done, &batch->lock);
+
+    uint32_t parsed = run->parsed;
+    pthread_mutex_unlock(&batch->lock);
+
+    free(estimate);
+    free(items);
+    return parsed;
+}
+
+/**
+ *
+ */
+void xtp_batch_free(xentrace_batch batch) {
+    pthread_mutex_lock(&batch->lock);
+    (batch->run).shutdown = 1;
+    pthread_cond_broadcast(&batch->start);
+    pthread_mutex_unlock(&batch->lock);
+
+    for (uint16_t i = 0; i < batch->threads; ++i) {
+        pthread_join((batch->workers[i]).thread, NULL);
+        pthread_mutex_destroy(&(batch->workers[i]).deque.lock);
+    }
+
+    pthread_cond_destroy(&batch->memory);
+    pthread_cond_destroy(&batch->done);
+    pthread_cond_destroy(&batch->start);
+    pthread_mutex_destroy(&batch->lock);
+
+    free(batch->workers);
+    free(batch);
+}
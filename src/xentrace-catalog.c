@@ -0,0 +1,300 @@
+/**
+ * Event-ID catalog for XenTrace binary data - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "xentrace-alloc.h"
+#include "xentrace-catalog.h"
+#include "xentrace-lazy.h"
+
+#define ARR_ENTRIES_SSIZE 64
+
+/**
+ * Event-ID catalog.
+ * Entries are indexed by an open addressing
+ * hash table holding "entry position + 1".
+ */
+struct __catalog {
+    const xt_allocator *alloc;  // Memory allocator
+
+    // Entry list related vars
+    struct __entry_l {
+        xt_catalog *ptr;  // Array pointer
+        uint32_t length,  // Array length
+                count;    // Elements count
+    } entry_l;
+
+    // Hash table related vars
+    struct __hash_t {
+        uint32_t *ptr;    // Slots pointer
+        uint32_t length;  // Slots count (power of 2)
+    } hash_t;
+
+    // Position lists related vars
+    struct __pos_l {
+        uint32_t *ptr,    // All the lists, one after another
+                *start;   // Per entry list start
+        uint32_t count,   // Positions count
+                lists;    // Lists count
+        uint8_t enabled;  // Build on finish?
+    } pos_l;
+};
+
+/**
+ *
+ */
+static uint32_t hash_id(uint32_t id) {
+    // Fibonacci hashing, IDs are mostly sequential
+    return id * 2654435769u;
+}
+
+/**
+ *
+ */
+static uint32_t *find_slot(const struct __catalog *cat, uint32_t id) {
+    const struct __hash_t *hash_t = &cat->hash_t;
+    uint32_t mask = hash_t->length - 1,
+            slot  = hash_id(id) & mask;
+
+    // Linear probing
+    while (hash_t->ptr[slot]) {
+        if (((cat->entry_l).ptr[ hash_t->ptr[slot] - 1 ]).id == id)
+            break;
+
+        slot = (slot + 1) & mask;
+    }
+
+    return hash_t->ptr + slot;
+}
+
+/**
+ *
+ */
+static int rehash(struct __catalog *cat, uint32_t length) {
+    uint32_t *new_ptr = xt_zalloc(cat->alloc, sizeof(*new_ptr) * length);
+    if (!new_ptr)
+        return 0;
+
+    struct __hash_t *hash_t = &cat->hash_t;
+    xt_free(cat->alloc, hash_t->ptr, sizeof(*hash_t->ptr) * hash_t->length);
+    hash_t->ptr    = new_ptr;
+    hash_t->length = length;
+
+    struct __entry_l *entry_l = &cat->entry_l;
+    for (uint32_t i = 0; i < entry_l->count; ++i)
+        *find_slot(cat, (entry_l->ptr[i]).id) = i + 1;
+
+    return 1;
+}
+
+/**
+ *
+ */
+struct __catalog *catalog_new(const xt_allocator *alloc, int positions) {
+    struct __catalog *cat = xt_zalloc(alloc, sizeof(*cat));
+    if (!cat)
+        return NULL;
+
+    cat->alloc = alloc;
+
+    struct __entry_l *entry_l = &cat->entry_l;
+    entry_l->length = ARR_ENTRIES_SSIZE;
+    entry_l->ptr = xt_alloc(alloc, sizeof(*entry_l->ptr) * ARR_ENTRIES_SSIZE);
+
+    if (!entry_l->ptr || !rehash(cat, ARR_ENTRIES_SSIZE * 2)) {
+        catalog_free(cat);
+        return NULL;
+    }
+
+    (cat->pos_l).enabled = !!positions;
+    return cat;
+}
+
+/**
+ *
+ */
+int catalog_add(struct __catalog *cat, uint32_t id, uint64_t tsc) {
+    uint32_t *slot = find_slot(cat, id);
+
+    // Known ID
+    if (*slot) {
+        xt_catalog *entry = (cat->entry_l).ptr + *slot - 1;
+        entry->count++;
+
+        if (tsc < entry->first_tsc)
+            entry->first_tsc = tsc;
+        if (tsc > entry->last_tsc)
+            entry->last_tsc = tsc;
+
+        return 1;
+    }
+
+    // New ID, expand entry list (if needed)
+    struct __entry_l *entry_l = &cat->entry_l;
+    if (entry_l->count == entry_l->length) {
+        xt_catalog *new_ptr = xt_realloc(cat->alloc, entry_l->ptr,
+                                         sizeof(*entry_l->ptr) * entry_l->length,
+                                         sizeof(*entry_l->ptr) * entry_l->length * 2);
+        if (!new_ptr)
+            return 0;
+
+        entry_l->length *= 2;
+        entry_l->ptr = new_ptr;
+    }
+
+    xt_catalog *entry = entry_l->ptr + entry_l->count++;
+    entry->id        = id;
+    entry->count     = 1;
+    entry->first_tsc = tsc;
+    entry->last_tsc  = tsc;
+    *slot = entry_l->count;
+
+    // Keep the load factor under 1/2
+    if (entry_l->count * 2 > (cat->hash_t).length)
+        return rehash(cat, (cat->hash_t).length * 2);
+
+    return 1;
+}
+
+/**
+ *
+ */
+static int __qsort_cmpr(const void *a, const void *b) {
+    uint32_t x_id = ((xt_catalog *) a)->id,
+            y_id  = ((xt_catalog *) b)->id;
+
+    return (x_id > y_id) - (x_id < y_id);
+}
+
+/**
+ *
+ */
+int catalog_finish(struct __catalog *cat, const struct __source *src) {
+    struct __entry_l *entry_l = &cat->entry_l;
+    struct __pos_l *pos_l = &cat->pos_l;
+
+    // Sort entries, then fix up the hash table
+    qsort(entry_l->ptr, entry_l->count, sizeof(*entry_l->ptr), __qsort_cmpr);
+    if (!rehash(cat, (cat->hash_t).length))
+        return 0;
+
+    if (!pos_l->enabled)
+        return 1;
+
+    // One list per entry, laid out back to back
+    const xt_allocator *alloc = cat->alloc;
+    size_t fill_size = sizeof(uint32_t) * (entry_l->count ? entry_l->count : 1);
+
+    pos_l->count = src->count ? src->count : 1;
+    pos_l->lists = entry_l->count;
+    pos_l->ptr   = xt_alloc(alloc, sizeof(*pos_l->ptr) * pos_l->count);
+    pos_l->start = xt_alloc(alloc, sizeof(*pos_l->start) * (pos_l->lists + 1));
+    uint32_t *fill = xt_alloc(alloc, fill_size);
+
+    if (!pos_l->ptr || !pos_l->start || !fill) {
+        xt_free(alloc, fill, fill_size);
+        return 0;
+    }
+
+    pos_l->start[0] = 0;
+    for (uint32_t i = 0; i < entry_l->count; ++i) {
+        pos_l->start[i + 1] = pos_l->start[i] + (entry_l->ptr[i]).count;
+        fill[i] = pos_l->start[i];
+    }
+
+    int done = 1;
+    for (uint32_t i = 0; i < src->count; ++i) {
+        xt_event buf;
+        const xt_event *event = source_get(src, i, &buf);
+        if (!event) {
+            done = 0;
+            break;
+        }
+
+        uint32_t *slot = find_slot(cat, (event->rec).id);
+        if (*slot)
+            pos_l->ptr[ fill[*slot - 1]++ ] = i;
+    }
+
+    xt_free(alloc, fill, fill_size);
+    return done;
+}
+
+/**
+ *
+ */
+uint32_t catalog_count(const struct __catalog *cat) {
+    return cat ? (cat->entry_l).count : 0;
+}
+
+/**
+ *
+ */
+xt_catalog *catalog_get(const struct __catalog *cat, uint32_t pos) {
+    if (pos >= catalog_count(cat))
+        return NULL;
+
+    return (cat->entry_l).ptr + pos;
+}
+
+/**
+ *
+ */
+xt_catalog *catalog_find(const struct __catalog *cat, uint32_t id) {
+    if (!cat)
+        return NULL;
+
+    uint32_t slot = *find_slot(cat, id);
+    return slot ? (cat->entry_l).ptr + slot - 1 : NULL;
+}
+
+/**
+ *
+ */
+const uint32_t *catalog_positions(const struct __catalog *cat, uint32_t id, uint32_t *count) {
+    *count = 0;
+
+    const xt_catalog *entry = catalog_find(cat, id);
+    if (!entry || !(cat->pos_l).ptr)
+        return NULL;
+
+    uint32_t pos = entry - (cat->entry_l).ptr;
+    *count = entry->count;
+    return (cat->pos_l).ptr + (cat->pos_l).start[pos];
+}
+
+/**
+ *
+ */
+void catalog_free(struct __catalog *cat) {
+    if (!cat)
+        return;
+
+    const xt_allocator *alloc = cat->alloc;
+    struct __pos_l *pos_l = &cat->pos_l;
+
+    xt_free(alloc, pos_l->start, sizeof(*pos_l->start) * (pos_l->lists + 1));
+    xt_free(alloc, pos_l->ptr, sizeof(*pos_l->ptr) * pos_l->count);
+    xt_free(alloc, (cat->hash_t).ptr, sizeof(*(cat->hash_t).ptr) * (cat->hash_t).length);
+    xt_free(alloc, (cat->entry_l).ptr, sizeof(*(cat->entry_l).ptr) * (cat->entry_l).length);
+    xt_free(alloc, cat, sizeof(*cat));
+}
@@ -0,0 +1,86 @@
+/**
+ * Event-ID catalog for XenTrace binary data - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef __XTCATALOG_H
+#define __XTCATALOG_H
+
+#include <stdint.h>
+
+#include "xentrace-parser.h"
+
+/**
+ * Event-ID catalog (internal).
+ */
+struct __catalog;
+
+/**
+ * Create a new, empty catalog.
+ * If X is non-zero, position lists
+ * are built by catalog_finish().
+ * Returns NULL on error.
+ */
+struct __catalog *catalog_new(const xt_allocator *, int);
+
+/**
+ * Accounts an event ID seen at a TSC.
+ * Returns zero on error.
+ */
+int catalog_add(struct __catalog *, uint32_t, uint64_t);
+
+struct __source;
+
+/**
+ * Sorts the catalog by ID and builds the
+ * position lists of an event source.
+ * Returns zero on error.
+ */
+int catalog_finish(struct __catalog *, const struct __source *);
+
+/**
+ * Returns the distinct IDs count.
+ */
+uint32_t catalog_count(const struct __catalog *);
+
+/**
+ * Returns the entry at position X.
+ * Returns NULL on error.
+ */
+xt_catalog *catalog_get(const struct __catalog *, uint32_t);
+
+/**
+ * Returns the entry of an event ID.
+ * Returns NULL if not found.
+ */
+xt_catalog *catalog_find(const struct __catalog *, uint32_t);
+
+/**
+ * Returns the positions of an event ID,
+ * storing their count into X.
+ * Returns NULL if not available.
+ */
+const uint32_t *catalog_positions(const struct __catalog *, uint32_t, uint32_t *);
+
+/**
+ * Frees up a catalog.
+ */
+void catalog_free(struct __catalog *);
+
+#endif
@@ -0,0 +1,369 @@
+/**
+ * Gap index for XenTrace binary data - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// Xen Project
+#include <trace.h>
+
+#include "xentrace-alloc.h"
+#include "xentrace-gaps.h"
+
+#define ARR_GAPS_SSIZE 16
+#define ARR_PREV_SSIZE 8
+
+/**
+ * Gap index.
+ */
+struct __gaps {
+    const xt_allocator *alloc;  // Memory allocator
+
+    // Gap list related vars,
+    // sorted by hCPU and TSC once finished
+    struct __gap_l {
+        xt_gap *ptr;      // Array pointer
+        uint32_t length,  // Array length
+                count;    // Elements count
+    } gap_l;
+
+    // Lost records gaps of all
+    // the hCPUs, sorted by TSC
+    struct __lost_l {
+        xt_gap *ptr;      // Array pointer
+        uint32_t count;   // Elements count
+    } lost_l;
+
+    // Per hCPU index
+    struct __cpu_i {
+        uint32_t *start;  // First gap of each hCPU
+        uint16_t count;   // hCPUs count
+    } cpu_i;
+
+    // Per hCPU last TSC seen
+    struct __prev_l {
+        uint64_t *ptr;    // Array pointer
+        uint32_t length;  // Array length
+    } prev_l;
+};
+
+/**
+ *
+ */
+struct __gaps *gaps_new(const xt_allocator *alloc) {
+    struct __gaps *gaps = xt_zalloc(alloc, sizeof(*gaps));
+    if (!gaps)
+        return NULL;
+
+    gaps->alloc = alloc;
+
+    struct __gap_l *gap_l = &gaps->gap_l;
+    gap_l->length = ARR_GAPS_SSIZE;
+    gap_l->ptr = xt_alloc(alloc, sizeof(*gap_l->ptr) * ARR_GAPS_SSIZE);
+
+    struct __prev_l *prev_l = &gaps->prev_l;
+    prev_l->length = ARR_PREV_SSIZE;
+    prev_l->ptr = xt_zalloc(alloc, sizeof(*prev_l->ptr) * ARR_PREV_SSIZE);
+
+    if (!gap_l->ptr || !prev_l->ptr) {
+        gaps_free(gaps);
+        return NULL;
+    }
+
+    return gaps;
+}
+
+/**
+ *
+ */
+static int expand_prev_list(const xt_allocator *alloc, struct __prev_l *prev_l, uint16_t cpu) {
+    uint32_t old_length = prev_l->length,
+            new_length  = cpu + 1;
+
+    // Check if expansion is needed
+    if (new_length <= old_length)
+        return -1; // Not needed
+
+    // (Try to) Expand array list
+    uint64_t *new_ptr = xt_realloc(alloc, prev_l->ptr, sizeof(*prev_l->ptr) * old_length,
+                                   sizeof(*prev_l->ptr) * new_length);
+    if (!new_ptr)
+        return 0;
+
+    memset(new_ptr + old_length, 0, sizeof(*new_ptr) * (new_length - old_length));
+    prev_l->length = new_length;
+    prev_l->ptr = new_ptr;
+    return 1;
+}
+
+/**
+ *
+ */
+static int append_gap(const xt_allocator *alloc, struct __gap_l *gap_l, const xt_gap *gap) {
+    // Expand gap list (if needed)
+    if (gap_l->count == gap_l->length) {
+        xt_gap *new_ptr = xt_realloc(alloc, gap_l->ptr, sizeof(*gap_l->ptr) * gap_l->length,
+                                     sizeof(*gap_l->ptr) * gap_l->length * 2);
+        if (!new_ptr)
+            return 0;
+
+        gap_l->length *= 2;
+        gap_l->ptr = new_ptr;
+    }
+
+    gap_l->ptr[ gap_l->count++ ] = *gap;
+    return 1;
+}
+
+/**
+ *
+ */
+int gaps_add(struct __gaps *gaps, uint16_t cpu, const xt_record *rec) {
+    struct __prev_l *prev_l = &gaps->prev_l;
+    if (!expand_prev_list(gaps->alloc, prev_l, cpu))
+        return 0;
+
+    uint64_t prev_tsc = prev_l->ptr[cpu];
+    prev_l->ptr[cpu] = rec->tsc;
+
+    xt_gap gap = { .start_tsc = rec->tsc, .end_tsc = rec->tsc, .cpu = cpu };
+
+    switch (rec->id) {
+        case TRC_LOST_RECORDS:
+            // Records were lost from "first_tsc" (or,
+            // if missing, the previous record) up to now
+            gap.kind = XTP_GAP_LOST;
+            gap.lost = rec->n_extra ? rec->extra[0] : 0;
+
+            uint64_t first_tsc = rec->n_extra >= 4
+                ? rec->extra[2] | (uint64_t) rec->extra[3] << 32
+                : 0;
+
+            if (first_tsc && first_tsc <= rec->tsc)
+                gap.start_tsc = first_tsc;
+            else if (prev_tsc)
+                gap.start_tsc = prev_tsc;
+            break;
+
+        case TRC_TRACE_WRAP_BUFFER:
+            // Just a marker, nothing is lost
+            gap.kind = XTP_GAP_WRAP;
+            break;
+
+        default:
+            return 1;
+    }
+
+    return append_gap(gaps->alloc, &gaps->gap_l, &gap);
+}
+
+/**
+ *
+ */
+static int __qsort_cmpr_cpu(const void *a, const void *b) {
+    const xt_gap *x = a, *y = b;
+
+    if (x->cpu != y->cpu)
+        return (x->cpu > y->cpu) - (x->cpu < y->cpu);
+
+    return (x->start_tsc > y->start_tsc) - (x->start_tsc < y->start_tsc);
+}
+
+/**
+ *
+ */
+static int __qsort_cmpr_tsc(const void *a, const void *b) {
+    uint64_t x_tsc = ((xt_gap *) a)->start_tsc,
+            y_tsc  = ((xt_gap *) b)->start_tsc;
+
+    return (x_tsc > y_tsc) - (x_tsc < y_tsc);
+}
+
+/**
+ *
+ */
+int gaps_finish(struct __gaps *gaps, uint16_t cpus) {
+    struct __gap_l *gap_l = &gaps->gap_l;
+    struct __lost_l *lost_l = &gaps->lost_l;
+    struct __cpu_i *cpu_i = &gaps->cpu_i;
+
+    // Free up no-more-needed last TSC list
+    struct __prev_l *prev_l = &gaps->prev_l;
+    xt_free(gaps->alloc, prev_l->ptr, sizeof(*prev_l->ptr) * prev_l->length);
+    prev_l->ptr = NULL;
+
+    qsort(gap_l->ptr, gap_l->count, sizeof(*gap_l->ptr), __qsort_cmpr_cpu);
+
+    // Index the first gap of each hCPU (the lost records
+    // list is sized as the whole gap list, so that it
+    // can be freed without counting them again)
+    cpu_i->count = cpus;
+    cpu_i->start = xt_alloc(gaps->alloc, sizeof(*cpu_i->start) * (cpus + 1));
+    lost_l->ptr = xt_alloc(gaps->alloc, sizeof(*lost_l->ptr) * gap_l->length);
+    if (!cpu_i->start || !lost_l->ptr)
+        return 0;
+
+    uint32_t pos = 0;
+    for (uint32_t cpu = 0; cpu <= cpus; ++cpu) {
+        while (pos < gap_l->count && (gap_l->ptr[pos]).cpu < cpu)
+            ++pos;
+
+        cpu_i->start[cpu] = pos;
+    }
+
+    // Merge the lost records of all the hCPUs
+    for (uint32_t i = 0; i < gap_l->count; ++i)
+        if ((gap_l->ptr[i]).kind == XTP_GAP_LOST)
+            lost_l->ptr[ lost_l->count++ ] = gap_l->ptr[i];
+
+    qsort(lost_l->ptr, lost_l->count, sizeof(*lost_l->ptr), __qsort_cmpr_tsc);
+    return 1;
+}
+
+/**
+ *
+ */
+uint32_t gaps_count(const struct __gaps *gaps, uint16_t cpu) {
+    if (!gaps || !(gaps->cpu_i).start)
+        return 0;
+
+    if (cpu == XTP_ALL_CPUS)
+        return (gaps->gap_l).count;
+
+    if (cpu >= (gaps->cpu_i).count)
+        return 0;
+
+    return (gaps->cpu_i).start[cpu + 1] - (gaps->cpu_i).start[cpu];
+}
+
+/**
+ *
+ */
+xt_gap *gaps_get(const struct __gaps *gaps, uint16_t cpu, uint32_t pos) {
+    if (pos >= gaps_count(gaps, cpu))
+        return NULL;
+
+    if (cpu == XTP_ALL_CPUS)
+        return (gaps->gap_l).ptr + pos;
+
+    return (gaps->gap_l).ptr + (gaps->cpu_i).start[cpu] + pos;
+}
+
+/**
+ * Walks the complement of a TSC sorted gap list
+ * within a window, storing up to X clean windows.
+ * Returns the windows count, "clean" gets the
+ * gap-free cycles.
+ */
+static uint32_t walk_clean(const xt_gap *gap, uint32_t count, uint64_t from, uint64_t to,
+                           xt_window *out, uint32_t max, uint64_t *clean) {
+    uint64_t cursor = from;
+    uint32_t windows = 0;
+    *clean = 0;
+
+    for (uint32_t i = 0; i < count && cursor < to; ++i, ++gap) {
+        if (gap->kind != XTP_GAP_LOST || gap->end_tsc <= cursor)
+            continue;
+
+        if (gap->start_tsc >= to)
+            break;
+
+        if (gap->start_tsc > cursor) {
+            if (windows < max)
+                out[windows] = (xt_window) { cursor, gap->start_tsc };
+
+            *clean += gap->start_tsc - cursor;
+            windows++;
+        }
+
+        cursor = gap->end_tsc;
+    }
+
+    if (cursor < to) {
+        if (windows < max)
+            out[windows] = (xt_window) { cursor, to };
+
+        *clean += to - cursor;
+        windows++;
+    }
+
+    return windows;
+}
+
+/**
+ *
+ */
+static const xt_gap *sorted_gaps(const struct __gaps *gaps, uint16_t cpu, uint32_t *count) {
+    if (cpu == XTP_ALL_CPUS) {
+        *count = (gaps->lost_l).count;
+        return (gaps->lost_l).ptr;
+    }
+
+    *count = gaps_count(gaps, cpu);
+    return *count ? gaps_get(gaps, cpu, 0) : NULL;
+}
+
+/**
+ *
+ */
+double gaps_coverage(const struct __gaps *gaps, uint16_t cpu, uint64_t from, uint64_t to) {
+    if (!gaps || !(gaps->cpu_i).start || from >= to)
+        return 0;
+
+    uint32_t count;
+    uint64_t clean;
+    const xt_gap *gap = sorted_gaps(gaps, cpu, &count);
+
+    walk_clean(gap, count, from, to, NULL, 0, &clean);
+    return (double) clean / (double) (to - from);
+}
+
+/**
+ *
+ */
+uint32_t gaps_windows(const struct __gaps *gaps, uint16_t cpu, uint64_t from, uint64_t to,
+                      xt_window *out, uint32_t max) {
+    if (!gaps || !(gaps->cpu_i).start || from >= to)
+        return 0;
+
+    uint32_t count;
+    uint64_t clean;
+    const xt_gap *gap = sorted_gaps(gaps, cpu, &count);
+
+    return walk_clean(gap, count, from, to, out, max, &clean);
+}
+
+/**
+ *
+ */
+void gaps_free(struct __gaps *gaps) {
+    if (!gaps)
+        return;
+
+    const xt_allocator *alloc = gaps->alloc;
+
+    xt_free(alloc, (gaps->lost_l).ptr, sizeof(*(gaps->lost_l).ptr) * (gaps->gap_l).length);
+    xt_free(alloc, (gaps->cpu_i).start, sizeof(*(gaps->cpu_i).start) * ((gaps->cpu_i).count + 1));
+    xt_free(alloc, (gaps->prev_l).ptr, sizeof(*(gaps->prev_l).ptr) * (gaps->prev_l).length);
+    xt_free(alloc, (gaps->gap_l).ptr, sizeof(*(gaps->gap_l).ptr) * (gaps->gap_l).length);
+    xt_free(alloc, gaps, sizeof(*gaps));
+}
@@ -0,0 +1,79 @@
+/**
+ * Gap index for XenTrace binary data - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef __XTGAPS_H
+#define __XTGAPS_H
+
+#include <stdint.h>
+
+#include "xentrace-parser.h"
+
+/**
+ * Gap index (internal).
+ */
+struct __gaps;
+
+/**
+ * Create a new, empty gap index.
+ * Returns NULL on error.
+ */
+struct __gaps *gaps_new(const xt_allocator *);
+
+/**
+ * Accounts a record decoded on an hCPU.
+ * Returns zero on error.
+ */
+int gaps_add(struct __gaps *, uint16_t, const xt_record *);
+
+/**
+ * Sorts the gaps and builds the per hCPU index.
+ * Returns zero on error.
+ */
+int gaps_finish(struct __gaps *, uint16_t);
+
+/**
+ * Returns the gaps count of an hCPU.
+ */
+uint32_t gaps_count(const struct __gaps *, uint16_t);
+
+/**
+ * Returns the gap at position X of an hCPU.
+ * Returns NULL on error.
+ */
+xt_gap *gaps_get(const struct __gaps *, uint16_t, uint32_t);
+
+/**
+ * Returns the gap-free fraction of a TSC window.
+ */
+double gaps_coverage(const struct __gaps *, uint16_t, uint64_t, uint64_t);
+
+/**
+ * Stores up to X gap-free windows of a TSC window.
+ * Returns the windows count.
+ */
+uint32_t gaps_windows(const struct __gaps *, uint16_t, uint64_t, uint64_t, xt_window *, uint32_t);
+
+/**
+ * Frees up a gap index.
+ */
+void gaps_free(struct __gaps *);
+
+#endif
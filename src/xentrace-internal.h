@@ -0,0 +1,46 @@
+/**
+ * Internal API of XenTrace binary data parser - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef __XTINTERNAL_H
+#define __XTINTERNAL_H
+
+#include <stdint.h>
+
+#include "xentrace-parser.h"
+
+/**
+ * Like xtp_init_alloc(), but adopts an existing
+ * event list of Y elements, allocated by the
+ * given allocator (it is freed on error).
+ * The list is not shrunk after the parsing,
+ * so that it can be taken back.
+ * Returns NULL on error.
+ */
+xentrace_parser xtp_init_events(const char*, const xt_allocator*, xt_event*, uint32_t);
+
+/**
+ * Takes the event list away from an instance,
+ * storing its length (in elements) into X.
+ * The instance is left empty.
+ */
+xt_event *xtp_take_events(xentrace_parser, uint32_t*);
+
+#endif
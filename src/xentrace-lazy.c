@@ -0,0 +1,282 @@
+/**
+ * Lazy decoding for XenTrace binary data - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Xen Project
+#include <trace.h>
+
+#include "xentrace-alloc.h"
+#include "xentrace-lazy.h"
+
+#define ARR_ENTRIES_SSIZE 4096
+#define LAZY_CPU_BITS 16
+#define LAZY_MAX_OFFSET ((uint64_t) 1 << (64 - LAZY_CPU_BITS))
+
+/**
+ * Record table over a mapped trace file.
+ */
+struct __lazy {
+    const xt_allocator *alloc;  // Memory allocator
+
+    // File mapping related vars
+    struct __map {
+        const uint8_t *ptr;  // Mapping address
+        size_t size;         // File size
+    } map;
+
+    // Record table related vars,
+    // sorted by TSC once finished
+    struct __entry_l {
+        struct __entry {
+            uint64_t tsc,        // Record TSC (or the last one seen)
+                    off_cpu;     // File offset (high bits) and hCPU (low bits)
+            xt_domain dom;       // Domain running on the hCPU
+            uint32_t id:28;      // Record identifier
+            uint8_t n_extra:3,   // N# items in extra[] array
+                    in_tsc:1;    // Include t.s.c. ?
+        } *ptr;
+        uint32_t length,  // Array length
+                count;    // Elements count
+    } entry_l;
+};
+
+/**
+ *
+ */
+struct __lazy *lazy_new(const xt_allocator *alloc, const char *file) {
+    int fd = open(file, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) || (uint64_t) st.st_size >= LAZY_MAX_OFFSET) {
+        close(fd);
+        return NULL;
+    }
+
+    struct __lazy *lazy = xt_zalloc(alloc, sizeof(*lazy));
+    if (!lazy) {
+        close(fd);
+        return NULL;
+    }
+
+    lazy->alloc = alloc;
+
+    // Map the whole file (an empty one has no mapping)
+    struct __map *map = &lazy->map;
+    if (st.st_size) {
+        void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            close(fd);
+            lazy_free(lazy);
+            return NULL;
+        }
+
+        // The first pass reads it front to back
+        madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+        map->ptr  = ptr;
+        map->size = st.st_size;
+    }
+
+    close(fd);
+
+    struct __entry_l *entry_l = &lazy->entry_l;
+    entry_l->length = ARR_ENTRIES_SSIZE;
+    entry_l->ptr = xt_alloc(alloc, sizeof(*entry_l->ptr) * ARR_ENTRIES_SSIZE);
+    if (!entry_l->ptr) {
+        lazy_free(lazy);
+        return NULL;
+    }
+
+    return lazy;
+}
+
+/**
+ *
+ */
+size_t lazy_read(const struct __lazy *lazy, uint64_t offset, xt_record *rec) {
+    const struct __map *map = &lazy->map;
+
+    // Read header
+    uint32_t hdr;
+    if (offset + sizeof(hdr) > map->size)
+        return 0;
+
+    memcpy(&hdr, map->ptr + offset, sizeof(hdr));
+    rec->id      = TRC_HD_TO_EVENT(hdr);
+    rec->n_extra = TRC_HD_EXTRA(hdr);
+    rec->in_tsc  = TRC_HD_INCLUDES_CYCLE_COUNT(hdr);
+
+    size_t size = sizeof(hdr)
+        + (rec->in_tsc ? sizeof(rec->tsc) : 0)
+        + sizeof(rec->extra[0]) * rec->n_extra;
+
+    // Truncated record
+    if (offset + size > map->size)
+        return 0;
+
+    // Read the Time Stamp Counter (if any)
+    const uint8_t *ptr = map->ptr + offset + sizeof(hdr);
+    if (rec->in_tsc) {
+        memcpy(&rec->tsc, ptr, sizeof(rec->tsc));
+        ptr += sizeof(rec->tsc);
+    }
+
+    // Read extra[] array (if any)
+    memcpy(rec->extra, ptr, sizeof(rec->extra[0]) * rec->n_extra);
+
+    // Clear the unused items
+    memset(rec->extra + rec->n_extra, 0, sizeof(rec->extra[0]) * (XEN_REC_XTRS - rec->n_extra));
+    return size;
+}
+
+/**
+ *
+ */
+int lazy_add(struct __lazy *lazy, uint64_t offset, uint16_t cpu, xt_domain dom, const xt_record *rec) {
+    struct __entry_l *entry_l = &lazy->entry_l;
+
+    // Expand record table (if needed)
+    if (entry_l->count == entry_l->length) {
+        struct __entry *new_ptr = xt_realloc(lazy->alloc, entry_l->ptr,
+                                             sizeof(*entry_l->ptr) * entry_l->length,
+                                             sizeof(*entry_l->ptr) * entry_l->length * 2);
+        if (!new_ptr)
+            return 0;
+
+        entry_l->length *= 2;
+        entry_l->ptr = new_ptr;
+    }
+
+    struct __entry *entry = entry_l->ptr + entry_l->count++;
+    entry->tsc     = rec->tsc;
+    entry->off_cpu = offset << LAZY_CPU_BITS | cpu;
+    entry->dom     = dom;
+    entry->id      = rec->id;
+    entry->n_extra = rec->n_extra;
+    entry->in_tsc  = rec->in_tsc;
+    return 1;
+}
+
+/**
+ *
+ */
+static int __qsort_cmpr(const void *a, const void *b) {
+    const struct __entry *x = a, *y = b;
+
+    // Equal TSCs keep the file order
+    if (x->tsc != y->tsc)
+        return (x->tsc > y->tsc) - (x->tsc < y->tsc);
+
+    return (x->off_cpu > y->off_cpu) - (x->off_cpu < y->off_cpu);
+}
+
+/**
+ *
+ */
+void lazy_finish(struct __lazy *lazy) {
+    struct __entry_l *entry_l = &lazy->entry_l;
+
+    // Free up unused array space
+    if (entry_l->count) {
+        struct __entry *new_ptr = xt_realloc(lazy->alloc, entry_l->ptr,
+                                             sizeof(*entry_l->ptr) * entry_l->length,
+                                             sizeof(*entry_l->ptr) * entry_l->count);
+        if (new_ptr) {
+            entry_l->ptr = new_ptr;
+            entry_l->length = entry_l->count;
+        }
+    }
+
+    qsort(entry_l->ptr, entry_l->count, sizeof(*entry_l->ptr), __qsort_cmpr);
+
+    // From now on, records are read here and there
+    struct __map *map = &lazy->map;
+    if (map->ptr)
+        madvise((void *) map->ptr, map->size, MADV_RANDOM);
+}
+
+/**
+ *
+ */
+uint32_t lazy_count(const struct __lazy *lazy) {
+    return lazy ? (lazy->entry_l).count : 0;
+}
+
+/**
+ *
+ */
+xt_event *lazy_decode(const struct __lazy *lazy, uint32_t pos, xt_event *event) {
+    if (pos >= lazy_count(lazy))
+        return NULL;
+
+    const struct __entry *entry = (lazy->entry_l).ptr + pos;
+    if (!lazy_read(lazy, entry->off_cpu >> LAZY_CPU_BITS, &event->rec))
+        return NULL;
+
+    event->cpu = (uint16_t) entry->off_cpu;
+    event->dom = entry->dom;
+    (event->rec).tsc = entry->tsc;
+    return event;
+}
+
+/**
+ *
+ */
+xt_event *lazy_peek(const struct __lazy *lazy, uint32_t pos, xt_event *event) {
+    if (pos >= lazy_count(lazy))
+        return NULL;
+
+    // Everything but extra[] is in the table
+    const struct __entry *entry = (lazy->entry_l).ptr + pos;
+    memset(event, 0, sizeof(*event));
+
+    event->cpu = (uint16_t) entry->off_cpu;
+    event->dom = entry->dom;
+    (event->rec).id      = entry->id;
+    (event->rec).n_extra = entry->n_extra;
+    (event->rec).in_tsc  = entry->in_tsc;
+    (event->rec).tsc     = entry->tsc;
+    return event;
+}
+
+/**
+ *
+ */
+void lazy_free(struct __lazy *lazy) {
+    if (!lazy)
+        return;
+
+    struct __map *map = &lazy->map;
+    if (map->ptr)
+        munmap((void *) map->ptr, map->size);
+
+    struct __entry_l *entry_l = &lazy->entry_l;
+    xt_free(lazy->alloc, entry_l->ptr, sizeof(*entry_l->ptr) * entry_l->length);
+    xt_free(lazy->alloc, lazy, sizeof(*lazy));
+}
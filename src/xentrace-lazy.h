@@ -0,0 +1,103 @@
+/**
+ * Lazy decoding for XenTrace binary data - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef __XTLAZY_H
+#define __XTLAZY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "xentrace-parser.h"
+
+/**
+ * Record table over a mapped trace file (internal).
+ */
+struct __lazy;
+
+/**
+ * Event source, the TSC sorted events of an
+ * instance, either decoded or in a record table
+ * (whose events come without extra[] items).
+ */
+struct __source {
+    const xt_event *ptr;        // Decoded event list (if not lazy)
+    const struct __lazy *lazy;  // Record table (if lazy)
+    uint32_t count;             // Elements count
+};
+
+/**
+ * Maps a trace file and creates an empty record table.
+ * Returns NULL on error.
+ */
+struct __lazy *lazy_new(const xt_allocator *, const char *);
+
+/**
+ * Decodes the record at file offset X into Y.
+ * The TSC is left untouched if not included.
+ * Returns the record size, zero on error/end-of-file.
+ */
+size_t lazy_read(const struct __lazy *, uint64_t, xt_record *);
+
+/**
+ * Appends a record (file offset, hCPU, domain,
+ * header and TSC) to the table.
+ * Returns zero on error.
+ */
+int lazy_add(struct __lazy *, uint64_t, uint16_t, xt_domain, const xt_record *);
+
+/**
+ * Sorts the table by TSC.
+ */
+void lazy_finish(struct __lazy *);
+
+/**
+ * Returns the records count of the table.
+ */
+uint32_t lazy_count(const struct __lazy *);
+
+/**
+ * Decodes the event at position X into Y.
+ * Returns NULL on error.
+ */
+xt_event *lazy_decode(const struct __lazy *, uint32_t, xt_event *);
+
+/**
+ * Fills the event at position X into Y from
+ * the table only, without reading the file
+ * (extra[] items are left cleared).
+ * Returns NULL on error.
+ */
+xt_event *lazy_peek(const struct __lazy *, uint32_t, xt_event *);
+
+/**
+ * Unmaps the trace file and frees up a record table.
+ */
+void lazy_free(struct __lazy *);
+
+/**
+ * Returns the event at position X of a source,
+ * filling it into Y if needed (see lazy_peek()).
+ */
+static inline const xt_event *source_get(const struct __source *src, uint32_t pos, xt_event *buf) {
+    return src->lazy ? lazy_peek(src->lazy, pos, buf) : src->ptr + pos;
+}
+
+#endif
@@ -29,6 +29,12 @@
 #include <trace.h>
 
 #include "xentrace-parser.h"
+#include "xentrace-internal.h"
+#include "xentrace-alloc.h"
+#include "xentrace-catalog.h"
+#include "xentrace-gaps.h"
+#include "xentrace-lazy.h"
+#include "xentrace-summary.h"
 
 #define ARR_EVENTS_SSIZE 4096
 #define ARR_DOMS_SSIZE 8
@@ -41,6 +47,10 @@ struct __xentrace_parser {
     char *file;         // Trace file path
     uint64_t last_tsc;  // Last TSC readed
 
+    // Memory related vars
+    xt_allocator alloc;     // Allocator of every list
+    struct __arena *arena;  // Private arena (if any)
+
     // Host CPU related vars
     struct __hcpu {
         uint16_t current,  // Current hCPU
@@ -59,62 +69,147 @@ struct __xentrace_parser {
         uint32_t length,  // Array Length
                 count,    // Elements count
                 iter;     // Iterator position
+        uint8_t keep;     // Keep unused space?
     } event_l;
+
+    // Lost records gap index
+    struct __gaps *gaps;
+
+    // Timeline summary related vars
+    struct __summary_o {
+        struct __summary *ptr;  // Pyramid pointer
+        uint64_t width;         // Level 0 bucket width
+        uint8_t enabled;        // Build on execute?
+    } summary;
+
+    // Event-ID catalog related vars
+    struct __catalog_o {
+        struct __catalog *ptr;  // Catalog pointer
+        uint8_t enabled,        // Build on execute?
+                positions;      // Build position lists?
+    } catalog;
+
+    // Lazy decoding related vars
+    struct __lazy_o {
+        struct __lazy *ptr;  // Record table (NULL if not lazy)
+        xt_event event;      // Last decoded event
+    } lazy;
 };
 
 // Function prototypes
-static int expand_dom_list(struct __dom_l *, uint16_t);
+static int expand_dom_list(const xt_allocator *, struct __dom_l *, uint16_t);
 void xtp_free(xentrace_parser);
 
 /**
- *
+ * Create a new instance, whose memory comes
+ * from "alloc" (and "arena", if not NULL).
+ * The event list and the arena are freed on error.
  */
-xentrace_parser xtp_init(const char *file) {
+static xentrace_parser init_parser(const char *file, const xt_allocator *alloc,
+                                   struct __arena *arena, xt_event *events, uint32_t length) {
     // Check if file exists and is readable
-    if (access(file, R_OK))
+    if (access(file, R_OK)) {
+        xt_free(alloc, events, sizeof(*events) * length);
+        arena_free(arena);
         return NULL;
+    }
 
     // Initialize struct
-    struct __xentrace_parser *xtp = calloc(1, sizeof(*xtp));
-    if (!xtp)
+    struct __xentrace_parser *xtp = xt_zalloc(alloc, sizeof(*xtp));
+    if (!xtp) {
+        xt_free(alloc, events, sizeof(*events) * length);
+        arena_free(arena);
         return NULL;
+    }
+
+    xtp->alloc = *alloc;
+    xtp->arena = arena;
+
+    // Adopt the given event list (if any)
+    struct __event_l *event_l = &xtp->event_l;
+    if (events && length >= ARR_EVENTS_SSIZE) {
+        event_l->ptr    = events;
+        event_l->length = length;
+        event_l->keep   = 1;
+    } else {
+        xt_free(alloc, events, sizeof(*events) * length);
+    }
 
     // Copy file path
-    xtp->file = strdup(file);
+    size_t file_size = strlen(file) + 1;
+    xtp->file = xt_alloc(alloc, file_size);
     if (!xtp->file) {
         xtp_free(xtp);
         return NULL;
     }
 
+    memcpy(xtp->file, file, file_size);
+
     // Initialize hCPU domain list
-    int doms_ok = expand_dom_list(&xtp->dom_l, ARR_DOMS_SSIZE);
+    int doms_ok = expand_dom_list(&xtp->alloc, &xtp->dom_l, ARR_DOMS_SSIZE);
     if (!doms_ok) {
         xtp_free(xtp);
         return NULL;
     }
 
     // Initialize event list
-    struct __event_l *event_l = &xtp->event_l;
-    event_l->length = ARR_EVENTS_SSIZE;
-    event_l->ptr = malloc(sizeof(*event_l->ptr) * ARR_EVENTS_SSIZE);
     if (!event_l->ptr) {
-        xtp_free(xtp);
-        return NULL;
+        event_l->length = ARR_EVENTS_SSIZE;
+        event_l->ptr = xt_alloc(alloc, sizeof(*event_l->ptr) * ARR_EVENTS_SSIZE);
+        if (!event_l->ptr) {
+            xtp_free(xtp);
+            return NULL;
+        }
     }
 
     return xtp;
 }
 
+/**
+ *
+ */
+xentrace_parser xtp_init(const char *file) {
+    return init_parser(file, &xt_libc_allocator, NULL, NULL, 0);
+}
+
+/**
+ *
+ */
+xentrace_parser xtp_init_alloc(const char *file, const xt_allocator *alloc) {
+    return init_parser(file, alloc, NULL, NULL, 0);
+}
+
+/**
+ *
+ */
+xentrace_parser xtp_init_arena(const char *file, size_t chunk_size) {
+    struct __arena *arena = arena_new(chunk_size);
+    if (!arena)
+        return NULL;
+
+    xt_allocator alloc = arena_allocator(arena);
+    return init_parser(file, &alloc, arena, NULL, 0);
+}
+
+/**
+ *
+ */
+xentrace_parser xtp_init_events(const char *file, const xt_allocator *alloc,
+                                xt_event *events, uint32_t length) {
+    return init_parser(file, alloc, NULL, events, length);
+}
+
 /**
  * 
  */
-static int expand_event_list(struct __event_l *event_l)  {
+static int expand_event_list(const xt_allocator *alloc, struct __event_l *event_l)  {
     // Check if expansion is needed
     if (event_l->count + 1 < event_l->length)
         return -1; // Not needed
 
     // (Try to) Expand array list
-    xt_event *new_ptr = realloc(event_l->ptr, sizeof(*event_l->ptr) * event_l->length * 2);
+    xt_event *new_ptr = xt_realloc(alloc, event_l->ptr, sizeof(*event_l->ptr) * event_l->length,
+                                   sizeof(*event_l->ptr) * event_l->length * 2);
     if (!new_ptr)
         return 0;
 
@@ -126,7 +221,7 @@ static int expand_event_list(struct __event_l *event_l)  {
 /**
  *
  */
-static int expand_dom_list(struct __dom_l *dom_l, uint16_t cpu_id) {
+static int expand_dom_list(const xt_allocator *alloc, struct __dom_l *dom_l, uint16_t cpu_id) {
     uint32_t old_length = dom_l->length,
             new_length  = cpu_id + 1;
 
@@ -135,7 +230,8 @@ static int expand_dom_list(struct __dom_l *dom_l, uint16_t cpu_id) {
         return -1; // Not needed
 
     // (Try to) Expand array list
-    xt_domain *new_ptr = realloc(dom_l->ptr, sizeof(*dom_l->ptr) * new_length);
+    xt_domain *new_ptr = xt_realloc(alloc, dom_l->ptr, sizeof(*dom_l->ptr) * old_length,
+                                    sizeof(*dom_l->ptr) * new_length);
     if (!new_ptr)
         return 0;
 
@@ -183,6 +279,9 @@ static int read_next_record(FILE *fp, xt_record* rec) {
         if (fread(&rec->extra, sizeof(rec->extra[0]), rec->n_extra, fp) != rec->n_extra)
             return 0;
 
+    // Clear the unused items
+    memset(rec->extra + rec->n_extra, 0, sizeof(rec->extra[0]) * (XEN_REC_XTRS - rec->n_extra));
+
     return 1;
 }
 
@@ -231,7 +330,7 @@ static void upd_current_domvcpu(xentrace_parser xtp, xt_record *record) {
 
     // Get current domain for CPU X
     uint16_t hcpu_curr = (xtp->hcpu).current;
-    expand_dom_list(&xtp->dom_l, hcpu_curr);
+    expand_dom_list(&xtp->alloc, &xtp->dom_l, hcpu_curr);
     xt_domain *current_dom = (xtp->dom_l).ptr + hcpu_curr;
 
     // Update DOM and vCPU
@@ -241,62 +340,201 @@ static void upd_current_domvcpu(xentrace_parser xtp, xt_record *record) {
 /**
  *
  */
-uint32_t xtp_execute(xentrace_parser xtp) {
-    struct __event_l *event_l = &xtp->event_l;
+static xt_domain current_dom(xentrace_parser xtp, uint16_t cpu) {
+    // hCPUs that never switched domain
+    // run the default one
+    if (cpu >= (xtp->dom_l).length)
+        return (xt_domain) { .u32 = (uint32_t) XEN_DOM_DFLT << 16 };
 
-    // If array is already populated return count
-    if (event_l->count)
-        return event_l->count;
+    return (xtp->dom_l).ptr[cpu];
+}
 
-    // Initialize FILE*
-    FILE *fp = fopen(xtp->file, "rb");
-    if (!fp)
+/**
+ * Updates the parsing state with a record.
+ * Returns zero if the record is not an event.
+ */
+static int track_record(xentrace_parser xtp, xt_record *rec) {
+    // Update current host cpu
+    if (upd_current_hcpu(xtp, rec))
         return 0;
 
-    // Read trace's records
+    // Update current dom & vcpu
+    upd_current_domvcpu(xtp, rec);
+
+    // Set record TSC
+    set_record_tsc(xtp, rec);
+
+    return 1;
+}
+
+/**
+ * Updates the indexes with an event, once it
+ * has been saved (so that they never count
+ * an event the list does not hold).
+ */
+static void index_record(xentrace_parser xtp, const xt_record *rec) {
+    // Index lost records
+    if (xtp->gaps && !gaps_add(xtp->gaps, (xtp->hcpu).current, rec)) {
+        gaps_free(xtp->gaps);
+        xtp->gaps = NULL;
+    }
+
+    // Account event ID (if cataloging)
+    struct __catalog_o *catalog = &xtp->catalog;
+    if (catalog->ptr && !catalog_add(catalog->ptr, rec->id, rec->tsc)) {
+        catalog_free(catalog->ptr);
+        catalog->ptr = NULL;
+    }
+}
+
+/**
+ *
+ */
+static void read_events(xentrace_parser xtp, FILE *fp) {
+    struct __event_l *event_l = &xtp->event_l;
+
     xt_record rec;
     while (read_next_record(fp, &rec)) {
-        // Update current host cpu
-        if (upd_current_hcpu(xtp, &rec))
+        if (!track_record(xtp, &rec))
             continue;
 
-        // Update current dom & vcpu
-        upd_current_domvcpu(xtp, &rec);
-
-        // Set record TSC
-        set_record_tsc(xtp, &rec);
-
         // Save record into list
         // (and give a plus one to the event counter)
         xt_event *event = event_l->ptr + event_l->count++;
 
         event->cpu = (xtp->hcpu).current;
-        event->dom = (xtp->dom_l).ptr[ event->cpu ];
+        event->dom = current_dom(xtp, event->cpu);
         event->rec = rec;
 
+        index_record(xtp, &rec);
+
         // Expand nodes list (if needed),
         // otherwise stop reading the trace
-        if (!expand_event_list(event_l))
+        if (!expand_event_list(&xtp->alloc, event_l))
+            break;
+    }
+}
+
+/**
+ *
+ */
+static void read_lazy(xentrace_parser xtp) {
+    struct __lazy *lazy = (xtp->lazy).ptr;
+
+    // Only the position of each event
+    // is saved, records are decoded again
+    // when accessed
+    xt_record rec;
+    size_t size;
+    for (uint64_t offset = 0; (size = lazy_read(lazy, offset, &rec)); offset += size) {
+        if (!track_record(xtp, &rec))
+            continue;
+
+        uint16_t cpu = (xtp->hcpu).current;
+        if (!lazy_add(lazy, offset, cpu, current_dom(xtp, cpu), &rec))
             break;
+
+        index_record(xtp, &rec);
+    }
+}
+
+/**
+ *
+ */
+static struct __source event_source(xentrace_parser xtp) {
+    return (struct __source) {
+        .ptr   = (xtp->event_l).ptr,
+        .lazy  = (xtp->lazy).ptr,
+        .count = xtp_events_count(xtp),
+    };
+}
+
+/**
+ *
+ */
+uint32_t xtp_execute(xentrace_parser xtp) {
+    struct __event_l *event_l = &xtp->event_l;
+    struct __lazy_o *lazy = &xtp->lazy;
+
+    // If array is already populated return count
+    if (xtp_events_count(xtp))
+        return xtp_events_count(xtp);
+
+    // Initialize FILE* (if not lazy,
+    // otherwise the file is already mapped)
+    FILE *fp = NULL;
+    if (!lazy->ptr) {
+        fp = fopen(xtp->file, "rb");
+        if (!fp)
+            return 0;
     }
 
-    // Close FILE*
-    fclose(fp);
+    // Initialize gap index (dropping the one
+    // of a previous, empty, parsing), without
+    // it the trace is parsed all the same
+    gaps_free(xtp->gaps);
+    xtp->gaps = gaps_new(&xtp->alloc);
+
+    // Initialize catalog (if enabled)
+    struct __catalog_o *catalog = &xtp->catalog;
+    catalog_free(catalog->ptr);
+    catalog->ptr = NULL;
+
+    if (catalog->enabled)
+        catalog->ptr = catalog_new(&xtp->alloc, catalog->positions);
+
+    // Read trace's records
+    if (lazy->ptr) {
+        read_lazy(xtp);
+    } else {
+        read_events(xtp, fp);
+        fclose(fp);
+    }
 
     // Free up no-more-needed dom list
-    free((xtp->dom_l).ptr);
-    (xtp->dom_l).ptr = NULL;
+    struct __dom_l *dom_l = &xtp->dom_l;
+    xt_free(&xtp->alloc, dom_l->ptr, sizeof(*dom_l->ptr) * dom_l->length);
+    dom_l->ptr = NULL;
+    dom_l->length = 0;
 
     // Free up unused array space
-    xt_event *new_ptr = realloc(event_l->ptr, sizeof(*event_l->ptr) * event_l->count);
-    if (new_ptr)
-        event_l->ptr = new_ptr;
+    // (unless the list is going to be reused)
+    if (!event_l->keep && event_l->count) {
+        xt_event *new_ptr = xt_realloc(&xtp->alloc, event_l->ptr,
+                                       sizeof(*event_l->ptr) * event_l->length,
+                                       sizeof(*event_l->ptr) * event_l->count);
+        if (new_ptr) {
+            event_l->ptr = new_ptr;
+            event_l->length = event_l->count;
+        }
+    }
 
     // Sort list
-    qsort(event_l->ptr, event_l->count, sizeof(*event_l->ptr), __qsort_cmpr);
+    if (lazy->ptr)
+        lazy_finish(lazy->ptr);
+    else
+        qsort(event_l->ptr, event_l->count, sizeof(*event_l->ptr), __qsort_cmpr);
+
+    // Complete gap index
+    if (xtp->gaps && !gaps_finish(xtp->gaps, xtp_cpus_count(xtp))) {
+        gaps_free(xtp->gaps);
+        xtp->gaps = NULL;
+    }
+
+    // Complete catalog (if enabled)
+    struct __source src = event_source(xtp);
+    if (catalog->ptr && !catalog_finish(catalog->ptr, &src)) {
+        catalog_free(catalog->ptr);
+        catalog->ptr = NULL;
+    }
+
+    // Build summary (if enabled)
+    struct __summary_o *summary = &xtp->summary;
+    if (summary->enabled)
+        summary->ptr = summary_build(&xtp->alloc, &src, xtp_cpus_count(xtp), summary->width);
 
     // Return count
-    return event_l->count;
+    return src.count;
 }
 
 /**
@@ -310,6 +548,9 @@ uint16_t xtp_cpus_count(xentrace_parser xtp) {
  *
  */
 uint32_t xtp_events_count(xentrace_parser xtp) {
+    if ((xtp->lazy).ptr)
+        return lazy_count((xtp->lazy).ptr);
+
     return (xtp->event_l).count;
 }
 
@@ -317,6 +558,9 @@ uint32_t xtp_events_count(xentrace_parser xtp) {
  *
  */
 xt_event *xtp_get_event(xentrace_parser xtp, uint32_t pos) {
+    if ((xtp->lazy).ptr)
+        return lazy_decode((xtp->lazy).ptr, pos, &(xtp->lazy).event);
+
     if (pos >= (xtp->event_l).count)
         return NULL;
 
@@ -327,10 +571,24 @@ xt_event *xtp_get_event(xentrace_parser xtp, uint32_t pos) {
  *
  */
 xt_event *xtp_next_event(xentrace_parser xtp) {
-    if ((xtp->event_l).iter >= (xtp->event_l).count)
+    if ((xtp->event_l).iter >= xtp_events_count(xtp))
         return NULL;
 
-    return (xtp->event_l).ptr + (xtp->event_l).iter++;
+    return xtp_get_event(xtp, (xtp->event_l).iter++);
+}
+
+/**
+ *
+ */
+int xtp_read_event(xentrace_parser xtp, uint32_t pos, xt_event *event) {
+    if ((xtp->lazy).ptr)
+        return lazy_decode((xtp->lazy).ptr, pos, event) != NULL;
+
+    if (pos >= (xtp->event_l).count)
+        return 0;
+
+    *event = (xtp->event_l).ptr[pos];
+    return 1;
 }
 
 /**
@@ -340,12 +598,238 @@ void xtp_reset_iter(xentrace_parser xtp) {
     (xtp->event_l).iter = 0;
 }
 
+/**
+ *
+ */
+xt_event *xtp_take_events(xentrace_parser xtp, uint32_t *length) {
+    struct __event_l *event_l = &xtp->event_l;
+    xt_event *events = event_l->ptr;
+
+    *length = event_l->length;
+    event_l->ptr    = NULL;
+    event_l->length = 0;
+    event_l->count  = 0;
+    event_l->iter   = 0;
+
+    return events;
+}
+
+/**
+ *
+ */
+int xtp_set_lazy(xentrace_parser xtp) {
+    struct __event_l *event_l = &xtp->event_l;
+    struct __lazy_o *lazy = &xtp->lazy;
+
+    if (lazy->ptr)
+        return 1;
+
+    // Already parsed, or the event
+    // list is going to be reused
+    if (event_l->count || event_l->keep)
+        return 0;
+
+    lazy->ptr = lazy_new(&xtp->alloc, xtp->file);
+    if (!lazy->ptr)
+        return 0;
+
+    // Free up no-more-needed event list
+    xt_free(&xtp->alloc, event_l->ptr, sizeof(*event_l->ptr) * event_l->length);
+    event_l->ptr = NULL;
+    event_l->length = 0;
+    return 1;
+}
+
+/**
+ *
+ */
+int xtp_is_lazy(xentrace_parser xtp) {
+    return (xtp->lazy).ptr != NULL;
+}
+
+/**
+ *
+ */
+int xtp_set_summary(xentrace_parser xtp, uint64_t width) {
+    struct __summary_o *summary = &xtp->summary;
+
+    summary_free(summary->ptr);
+    summary->ptr     = NULL;
+    summary->width   = width;
+    summary->enabled = 1;
+
+    // Not parsed yet, build on execute
+    struct __source src = event_source(xtp);
+    if (!src.count)
+        return 1;
+
+    summary->ptr = summary_build(&xtp->alloc, &src, xtp_cpus_count(xtp), width);
+    return summary->ptr != NULL;
+}
+
+/**
+ *
+ */
+uint8_t xtp_summary_levels(xentrace_parser xtp) {
+    return summary_levels((xtp->summary).ptr);
+}
+
+/**
+ *
+ */
+uint32_t xtp_summary_length(xentrace_parser xtp, uint8_t level) {
+    return summary_length((xtp->summary).ptr, level);
+}
+
+/**
+ *
+ */
+uint64_t xtp_summary_width(xentrace_parser xtp, uint8_t level) {
+    return summary_width((xtp->summary).ptr, level);
+}
+
+/**
+ *
+ */
+xt_summary *xtp_summary_get(xentrace_parser xtp, uint8_t level, uint32_t pos) {
+    return summary_get((xtp->summary).ptr, level, pos);
+}
+
+/**
+ *
+ */
+float xtp_summary_busy(xentrace_parser xtp, uint8_t level, uint32_t pos, uint16_t cpu) {
+    return summary_busy((xtp->summary).ptr, level, pos, cpu);
+}
+
+/**
+ *
+ */
+uint32_t xtp_summary_pos(xentrace_parser xtp, uint8_t level, uint64_t tsc) {
+    return summary_pos((xtp->summary).ptr, level, tsc);
+}
+
+/**
+ *
+ */
+uint8_t xtp_summary_level_for(xentrace_parser xtp, uint64_t from, uint64_t to, uint32_t max) {
+    return summary_level_for((xtp->summary).ptr, from, to, max);
+}
+
+/**
+ *
+ */
+int xtp_set_catalog(xentrace_parser xtp, int positions) {
+    struct __catalog_o *catalog = &xtp->catalog;
+
+    catalog_free(catalog->ptr);
+    catalog->ptr       = NULL;
+    catalog->positions = !!positions;
+    catalog->enabled   = 1;
+
+    // Not parsed yet, build on execute
+    struct __source src = event_source(xtp);
+    if (!src.count)
+        return 1;
+
+    struct __catalog *cat = catalog_new(&xtp->alloc, positions);
+    if (!cat)
+        return 0;
+
+    for (uint32_t i = 0; i < src.count; ++i) {
+        xt_event buf;
+        const xt_event *event = source_get(&src, i, &buf);
+        if (!event || !catalog_add(cat, (event->rec).id, (event->rec).tsc)) {
+            catalog_free(cat);
+            return 0;
+        }
+    }
+
+    if (!catalog_finish(cat, &src)) {
+        catalog_free(cat);
+        return 0;
+    }
+
+    catalog->ptr = cat;
+    return 1;
+}
+
+/**
+ *
+ */
+uint32_t xtp_catalog_count(xentrace_parser xtp) {
+    return catalog_count((xtp->catalog).ptr);
+}
+
+/**
+ *
+ */
+xt_catalog *xtp_catalog_get(xentrace_parser xtp, uint32_t pos) {
+    return catalog_get((xtp->catalog).ptr, pos);
+}
+
+/**
+ *
+ */
+xt_catalog *xtp_catalog_find(xentrace_parser xtp, uint32_t id) {
+    return catalog_find((xtp->catalog).ptr, id);
+}
+
+/**
+ *
+ */
+const uint32_t *xtp_catalog_positions(xentrace_parser xtp, uint32_t id, uint32_t *count) {
+    return catalog_positions((xtp->catalog).ptr, id, count);
+}
+
+/**
+ *
+ */
+uint32_t xtp_gaps_count(xentrace_parser xtp, uint16_t cpu) {
+    return gaps_count(xtp->gaps, cpu);
+}
+
+/**
+ *
+ */
+xt_gap *xtp_get_gap(xentrace_parser xtp, uint16_t cpu, uint32_t pos) {
+    return gaps_get(xtp->gaps, cpu, pos);
+}
+
+/**
+ *
+ */
+double xtp_coverage(xentrace_parser xtp, uint16_t cpu, uint64_t from, uint64_t to) {
+    return gaps_coverage(xtp->gaps, cpu, from, to);
+}
+
+/**
+ *
+ */
+uint32_t xtp_clean_windows(xentrace_parser xtp, uint16_t cpu, uint64_t from, uint64_t to,
+                           xt_window *out, uint32_t max) {
+    return gaps_windows(xtp->gaps, cpu, from, to, out, max);
+}
+
 /**
  *
  */
 void xtp_free(xentrace_parser xtp) {
-    free((xtp->dom_l).ptr);
-    free((xtp->event_l).ptr);
-    free(xtp->file);
-    free(xtp);
+    // The trace file mapping is not in the arena
+    lazy_free((xtp->lazy).ptr);
+
+    // Everything else lives in the arena (if any)
+    if (xtp->arena) {
+        arena_free(xtp->arena);
+        return;
+    }
+
+    xt_allocator alloc = xtp->alloc;
+    gaps_free(xtp->gaps);
+    catalog_free((xtp->catalog).ptr);
+    summary_free((xtp->summary).ptr);
+    xt_free(&alloc, (xtp->dom_l).ptr, sizeof(*(xtp->dom_l).ptr) * (xtp->dom_l).length);
+    xt_free(&alloc, (xtp->event_l).ptr, sizeof(*(xtp->event_l).ptr) * (xtp->event_l).length);
+    xt_free(&alloc, xtp->file, xtp->file ? strlen(xtp->file) + 1 : 0);
+    xt_free(&alloc, xtp, sizeof(*xtp));
 }
\ No newline at end of file
@@ -22,15 +22,107 @@
 #ifndef __XTPARSER_H
 #define __XTPARSER_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "xentrace-event.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define XTP_SUMMARY_CLASSES 12
+
+#define XTP_GAP_LOST 0
+#define XTP_GAP_WRAP 1
+
+#define XTP_ALL_CPUS 0xffff
+
+/**
+ * Summary bucket struct.
+ * Classes are indexed by the bit number of
+ * the trace class (e.g. 3 for TRC_HVM).
+ * The dominant domain is tracked with 4
+ * candidates per bucket, at every level:
+ * "dom_tsc" is never below the busy cycles
+ * of "dom" in the bucket, and both are exact
+ * when at most 4 domains ran in it.
+ */
+typedef struct {
+    uint64_t tsc;                             // Bucket start
+    uint32_t events;                          // Events count
+    uint32_t classes[ XTP_SUMMARY_CLASSES ];  // Events count by class
+    uint16_t dom;                             // Dominant domain (approximate)
+    uint64_t dom_tsc;                         // Its busy cycles (upper bound)
+} xt_summary;
+
+/**
+ * Catalog entry struct.
+ */
+typedef struct {
+    uint32_t id;          // Event identifier
+    uint32_t count;       // Events count
+    uint64_t first_tsc,   // TSC of the first event
+            last_tsc;     // TSC of the last event
+} xt_catalog;
+
+/**
+ * Gap struct.
+ * XTP_GAP_LOST gaps span from the first lost
+ * record up to the TRC_LOST_RECORDS event,
+ * XTP_GAP_WRAP ones only mark a buffer wrap
+ * (start and end are the same TSC).
+ */
+typedef struct {
+    uint64_t start_tsc,  // Gap start
+            end_tsc;     // Gap end
+    uint32_t lost;       // Lost records count
+    uint16_t cpu;        // Host CPU value
+    uint8_t kind;        // XTP_GAP_LOST or XTP_GAP_WRAP
+} xt_gap;
+
+/**
+ * TSC window struct.
+ */
+typedef struct {
+    uint64_t start_tsc,  // Window start
+            end_tsc;     // Window end (excluded)
+} xt_window;
+
+/**
+ * Allocator struct.
+ * Every function receives "ctx" as first argument;
+ * realloc and free also receive the size the block
+ * was requested with, so that sized allocators
+ * (e.g. arenas or pools) don't need a header.
+ */
+typedef struct {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+    void (*free)(void *ctx, void *ptr, size_t size);
+    void *ctx;
+} xt_allocator;
+
 /**
  * XenTrace Parser instance pointer.
  */
 typedef struct __xentrace_parser *xentrace_parser;
 
+/**
+ * XenTrace Batch instance pointer.
+ */
+typedef struct __xentrace_batch *xentrace_batch;
+
+/**
+ * Batch callback, receives the parsed instance
+ * (NULL if it could not be created), the index
+ * of its path and the user context.
+ * It runs on a worker thread, concurrently with
+ * the other traces; the instance is freed as
+ * soon as it returns.
+ */
+typedef void (*xtp_batch_cb)(xentrace_parser, uint32_t, void*);
+
 /**
  * Create a new instance based on the
  * file path passed as an argument.
@@ -38,6 +130,25 @@ typedef struct __xentrace_parser *xentrace_parser;
  */
 xentrace_parser xtp_init(const char*);
 
+/**
+ * Like xtp_init(), but all the memory of the
+ * instance comes from the given allocator
+ * (copied, its context must outlive the instance).
+ * Returns NULL on error.
+ */
+xentrace_parser xtp_init_alloc(const char*, const xt_allocator*);
+
+/**
+ * Like xtp_init(), but all the memory of the
+ * instance comes from a private arena whose
+ * chunks are at least X bytes large (zero for
+ * the default); xtp_free() releases it at once.
+ * Large lists get their own mapping, backed by
+ * transparent huge pages where available.
+ * Returns NULL on error.
+ */
+xentrace_parser xtp_init_arena(const char*, size_t);
+
 /**
  * Performs trace parsing.
  * If a trace file is damaged, it will
@@ -60,6 +171,9 @@ uint32_t xtp_events_count(xentrace_parser);
 
 /**
  * Returns the event at position X of the list.
+ * In lazy mode the event is decoded on demand and
+ * it is valid until the next call to this function
+ * or to xtp_next_event().
  * Returns NULL on error.
  */
 xt_event *xtp_get_event(xentrace_parser, uint32_t);
@@ -67,18 +181,197 @@ xt_event *xtp_get_event(xentrace_parser, uint32_t);
 /**
  * Returns the next event in the list,
  * based on the position of the iterator.
+ * In lazy mode, see xtp_get_event().
  * Returns NULL on error/end-of-list.
  */
 xt_event *xtp_next_event(xentrace_parser);
 
+/**
+ * Copies the event at position X of the list
+ * into Y (decoding it, in lazy mode).
+ * Returns zero on error.
+ */
+int xtp_read_event(xentrace_parser, uint32_t, xt_event*);
+
 /**
  * Resets the list iterator.
  */
 void xtp_reset_iter(xentrace_parser);
 
+/**
+ * Enables lazy decoding, it must be called
+ * before xtp_execute(). The trace file is mapped
+ * and the parsing keeps only the TSC, position,
+ * hCPU, domain and ID of each event; records
+ * (with their extra[] items) are decoded again
+ * when accessed.
+ * Returns zero on error (e.g. already parsed).
+ */
+int xtp_set_lazy(xentrace_parser);
+
+/**
+ * Returns non-zero if lazy decoding is enabled.
+ */
+int xtp_is_lazy(xentrace_parser);
+
+/**
+ * Enables the timeline summary pyramid, built
+ * during the parsing. Level 0 buckets are X
+ * cycles wide (zero to choose automatically),
+ * each next level halves the buckets count.
+ * If the trace is already parsed, it is built
+ * immediately.
+ * Returns zero on error.
+ */
+int xtp_set_summary(xentrace_parser, uint64_t);
+
+/**
+ * Returns the levels count of the summary.
+ * Returns zero if not available.
+ */
+uint8_t xtp_summary_levels(xentrace_parser);
+
+/**
+ * Returns the buckets count of a summary level.
+ */
+uint32_t xtp_summary_length(xentrace_parser, uint8_t);
+
+/**
+ * Returns the buckets width of a summary level.
+ */
+uint64_t xtp_summary_width(xentrace_parser, uint8_t);
+
+/**
+ * Returns the bucket at position X of a summary level.
+ * The dominant domain is approximate (see xt_summary)
+ * at every level (XEN_DOM_IDLE if all hCPUs were idle).
+ * Returns NULL on error.
+ */
+xt_summary *xtp_summary_get(xentrace_parser, uint8_t, uint32_t);
+
+/**
+ * Returns the busy fraction (non-idle domain
+ * running) of an hCPU in a summary bucket,
+ * with a resolution of 1/65535.
+ */
+float xtp_summary_busy(xentrace_parser, uint8_t, uint32_t, uint16_t);
+
+/**
+ * Returns the position of the summary bucket
+ * that contains a TSC.
+ */
+uint32_t xtp_summary_pos(xentrace_parser, uint8_t, uint64_t);
+
+/**
+ * Returns the finest summary level that covers
+ * a TSC range with at most X buckets (e.g. the
+ * width in pixels of a timeline).
+ */
+uint8_t xtp_summary_level_for(xentrace_parser, uint64_t, uint64_t, uint32_t);
+
+/**
+ * Returns the gaps count of an hCPU
+ * (XTP_ALL_CPUS for all of them).
+ */
+uint32_t xtp_gaps_count(xentrace_parser, uint16_t);
+
+/**
+ * Returns the gap at position X of an hCPU
+ * (XTP_ALL_CPUS for all of them), gaps are
+ * sorted by hCPU and start TSC.
+ * Returns NULL on error.
+ */
+xt_gap *xtp_get_gap(xentrace_parser, uint16_t, uint32_t);
+
+/**
+ * Returns the fraction of a TSC window not
+ * affected by lost records on an hCPU (or on
+ * any of them, with XTP_ALL_CPUS).
+ * Returns zero on error or empty window.
+ */
+double xtp_coverage(xentrace_parser, uint16_t, uint64_t, uint64_t);
+
+/**
+ * Stores into the array (up to X elements) the
+ * windows of a TSC window not affected by lost
+ * records on an hCPU (or on any of them, with
+ * XTP_ALL_CPUS).
+ * Returns the windows count, which may be
+ * higher than X.
+ */
+uint32_t xtp_clean_windows(xentrace_parser, uint16_t, uint64_t, uint64_t, xt_window*, uint32_t);
+
+/**
+ * Enables the event-ID catalog, built during
+ * the parsing. If X is non-zero, the list of
+ * positions of every ID is built as well.
+ * If the trace is already parsed, it is built
+ * immediately.
+ * Returns zero on error.
+ */
+int xtp_set_catalog(xentrace_parser, int);
+
+/**
+ * Returns the distinct event IDs count.
+ * Returns zero if the catalog is not available.
+ */
+uint32_t xtp_catalog_count(xentrace_parser);
+
+/**
+ * Returns the catalog entry at position X,
+ * entries are sorted by event ID.
+ * Returns NULL on error.
+ */
+xt_catalog *xtp_catalog_get(xentrace_parser, uint32_t);
+
+/**
+ * Returns the catalog entry of an event ID.
+ * Returns NULL if not found.
+ */
+xt_catalog *xtp_catalog_find(xentrace_parser, uint32_t);
+
+/**
+ * Returns the (ascending) positions in the event
+ * list of an event ID, storing their count into X.
+ * Returns NULL if not found or not available.
+ */
+const uint32_t *xtp_catalog_positions(xentrace_parser, uint32_t, uint32_t*);
+
 /**
  * Frees up an instance.
  */
 void xtp_free(xentrace_parser);
 
+/**
+ * Create a new batch instance, with a pool of
+ * X worker threads (zero for one per online CPU)
+ * sharing a memory cap of Y bytes (zero for no
+ * cap) for the traces being parsed.
+ * The cap is a soft limit: traces are started
+ * against an estimate of their size, the memory
+ * they allocate past it is accounted as soon as
+ * it is allocated (delaying the next traces) but
+ * a trace in progress is never stopped.
+ * Returns NULL on error.
+ */
+xentrace_batch xtp_batch_init(uint16_t, uint64_t);
+
+/**
+ * Parses a list of traces on the thread pool,
+ * largest first, calling the callback for each.
+ * Event lists are reused between traces.
+ * Returns the number of traces parsed with
+ * at least one event.
+ */
+uint32_t xtp_batch_run(xentrace_batch, const char *const*, uint32_t, xtp_batch_cb, void*);
+
+/**
+ * Stops the workers and frees up a batch instance.
+ */
+void xtp_batch_free(xentrace_batch);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,399 @@
+/**
+ * C++ typed views for XenTrace binary data parser - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef __XTPARSER_HPP
+#define __XTPARSER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// Xen Project
+#include <trace.h>
+
+#include "xentrace-parser.h"
+
+namespace xentrace {
+
+/**
+ * Checks an event ID against a filter.
+ * A filter with a non-zero event number (lower
+ * 12 bits) must match exactly, otherwise it is
+ * a class/subclass mask with the same semantics
+ * of the Xen trace event mask (e.g. TRC_HVM,
+ * TRC_HVM_ENTRYEXIT or TRC_ALL).
+ */
+constexpr bool matches(uint32_t filter, uint32_t id) noexcept {
+    if (filter & 0xfff)
+        return id == filter;
+
+    return ((filter >> TRC_CLS_SHIFT) & (id >> TRC_CLS_SHIFT) & 0xfff)
+        && ((filter >> TRC_SUBCLS_SHIFT) & (id >> TRC_SUBCLS_SHIFT) & 0xf);
+}
+
+/**
+ * Base of every typed view.
+ * "Extras" is the number of extra[] items
+ * needed to decode all the named fields.
+ */
+template <uint32_t ID, unsigned Extras>
+class event_view {
+public:
+    static constexpr uint32_t id = ID;
+    static constexpr unsigned extras = Extras;
+
+    constexpr explicit event_view(const xt_event &event) noexcept : event_(&event) {}
+
+    // Generic fields
+    const xt_event &event() const noexcept { return *event_; }
+    uint16_t cpu() const noexcept { return event_->cpu; }
+    xt_domain dom() const noexcept { return event_->dom; }
+    uint64_t tsc() const noexcept { return (event_->rec).tsc; }
+
+    // Checks that the record carries all the named fields
+    bool valid() const noexcept { return (event_->rec).n_extra >= Extras; }
+
+protected:
+    uint32_t extra(unsigned i) const noexcept { return (event_->rec).extra[i]; }
+    uint64_t extra64(unsigned i) const noexcept {
+        return extra(i) | (uint64_t) extra(i + 1) << 32;
+    }
+
+private:
+    const xt_event *event_;
+};
+
+/**
+ * TRC_LOST_RECORDS
+ */
+struct lost_records : event_view<TRC_LOST_RECORDS, 4> {
+    using event_view::event_view;
+
+    uint32_t lost() const noexcept { return extra(0); }
+    uint16_t domid() const noexcept { return extra(1) & 0xffff; }
+    uint16_t vcpu() const noexcept { return extra(1) >> 16; }
+    uint64_t first_tsc() const noexcept { return extra64(2); }
+};
+
+/**
+ * TRC_SCHED_RUNSTATE_CHANGE
+ */
+struct runstate_change : event_view<TRC_SCHED_RUNSTATE_CHANGE, 2> {
+    using event_view::event_view;
+
+    uint16_t vcpu() const noexcept { return extra(0) & 0xffff; }
+    uint16_t domid() const noexcept { return extra(0) >> 16; }
+    uint8_t old_state() const noexcept { return extra(1) & 0xf; }
+    uint8_t new_state() const noexcept { return (extra(1) >> 4) & 0xf; }
+};
+
+/**
+ * TRC_SCHED_CONTINUE_RUNNING
+ */
+struct continue_running : event_view<TRC_SCHED_CONTINUE_RUNNING, 1> {
+    using event_view::event_view;
+
+    uint16_t vcpu() const noexcept { return extra(0) & 0xffff; }
+    uint16_t domid() const noexcept { return extra(0) >> 16; }
+};
+
+/**
+ * TRC_SCHED_SLEEP, TRC_SCHED_WAKE,
+ * TRC_SCHED_YIELD and TRC_SCHED_BLOCK
+ */
+template <uint32_t ID>
+struct sched_vcpu_event : event_view<ID, 2> {
+    using event_view<ID, 2>::event_view;
+
+    uint16_t domid() const noexcept { return this->extra(0); }
+    uint16_t vcpu() const noexcept { return this->extra(1); }
+};
+
+using sched_sleep = sched_vcpu_event<TRC_SCHED_SLEEP>;
+using sched_wake  = sched_vcpu_event<TRC_SCHED_WAKE>;
+using sched_yield = sched_vcpu_event<TRC_SCHED_YIELD>;
+using sched_block = sched_vcpu_event<TRC_SCHED_BLOCK>;
+
+/**
+ * TRC_SCHED_SWITCH
+ */
+struct sched_switch : event_view<TRC_SCHED_SWITCH, 4> {
+    using event_view::event_view;
+
+    uint16_t prev_domid() const noexcept { return extra(0); }
+    uint16_t prev_vcpu() const noexcept { return extra(1); }
+    uint16_t next_domid() const noexcept { return extra(2); }
+    uint16_t next_vcpu() const noexcept { return extra(3); }
+};
+
+/**
+ * TRC_SCHED_SWITCH_INFPREV
+ */
+struct sched_switch_infprev : event_view<TRC_SCHED_SWITCH_INFPREV, 3> {
+    using event_view::event_view;
+
+    uint16_t domid() const noexcept { return extra(0); }
+    uint16_t vcpu() const noexcept { return extra(1); }
+    uint32_t runtime() const noexcept { return extra(2); }
+};
+
+/**
+ * TRC_SCHED_SWITCH_INFNEXT
+ */
+struct sched_switch_infnext : event_view<TRC_SCHED_SWITCH_INFNEXT, 4> {
+    using event_view::event_view;
+
+    uint16_t domid() const noexcept { return extra(0); }
+    uint16_t vcpu() const noexcept { return extra(1); }
+    uint32_t waited() const noexcept { return extra(2); }
+    uint32_t slice() const noexcept { return extra(3); }
+};
+
+/**
+ * TRC_HVM_VMENTRY
+ */
+struct hvm_vmentry : event_view<TRC_HVM_VMENTRY, 0> {
+    using event_view::event_view;
+};
+
+/**
+ * TRC_HVM_VMEXIT
+ */
+struct hvm_vmexit : event_view<TRC_HVM_VMEXIT, 2> {
+    using event_view::event_view;
+
+    uint32_t exit_reason() const noexcept { return extra(0); }
+    uint64_t rip() const noexcept { return extra(1); }
+};
+
+/**
+ * TRC_HVM_VMEXIT64
+ */
+struct hvm_vmexit64 : event_view<TRC_HVM_VMEXIT64, 3> {
+    using event_view::event_view;
+
+    uint32_t exit_reason() const noexcept { return extra(0); }
+    uint64_t rip() const noexcept { return extra64(1); }
+};
+
+/**
+ * Registry of the typed views.
+ * Every entry gets a "typed<ID>" specialization
+ * and a case in the visit() switch.
+ */
+#define XENTRACE_TYPED_EVENTS(X)                           \
+    X(TRC_LOST_RECORDS,           lost_records)           \
+    X(TRC_SCHED_RUNSTATE_CHANGE,  runstate_change)        \
+    X(TRC_SCHED_CONTINUE_RUNNING, continue_running)       \
+    X(TRC_SCHED_SLEEP,            sched_sleep)            \
+    X(TRC_SCHED_WAKE,             sched_wake)             \
+    X(TRC_SCHED_YIELD,            sched_yield)            \
+    X(TRC_SCHED_BLOCK,            sched_block)            \
+    X(TRC_SCHED_SWITCH,           sched_switch)           \
+    X(TRC_SCHED_SWITCH_INFPREV,   sched_switch_infprev)   \
+    X(TRC_SCHED_SWITCH_INFNEXT,   sched_switch_infnext)   \
+    X(TRC_HVM_VMENTRY,            hvm_vmentry)            \
+    X(TRC_HVM_VMEXIT,             hvm_vmexit)             \
+    X(TRC_HVM_VMEXIT64,           hvm_vmexit64)
+
+/**
+ * Maps an event ID (or filter) to the type
+ * produced when dereferencing a filtered range.
+ * Unregistered IDs produce the raw event.
+ */
+template <uint32_t ID>
+struct typed {
+    using type = const xt_event &;
+};
+
+#define __XENTRACE_TYPED(ID, TYPE) \
+    template <> struct typed<ID> { using type = TYPE; };
+XENTRACE_TYPED_EVENTS(__XENTRACE_TYPED)
+#undef __XENTRACE_TYPED
+
+template <uint32_t ID>
+using typed_t = typename typed<ID>::type;
+
+/**
+ * Calls the visitor with the typed view of the
+ * event, or with the raw event if its ID is not
+ * registered. The dispatch is a plain switch,
+ * so the compiler can lower it to a jump table.
+ */
+template <typename Visitor>
+inline decltype(auto) visit(const xt_event &event, Visitor &&visitor) {
+    switch ((event.rec).id) {
+#define __XENTRACE_CASE(ID, TYPE) \
+    case ID: return std::forward<Visitor>(visitor)(TYPE(event));
+    XENTRACE_TYPED_EVENTS(__XENTRACE_CASE)
+#undef __XENTRACE_CASE
+    default:
+        return std::forward<Visitor>(visitor)(event);
+    }
+}
+
+/**
+ * Builds a visitor out of several lambdas.
+ */
+template <typename... Fs>
+struct overloaded : Fs... {
+    using Fs::operator()...;
+};
+
+template <typename... Fs>
+overloaded(Fs...) -> overloaded<Fs...>;
+
+/**
+ * Range over all the events of a parser.
+ */
+class event_range {
+public:
+    using iterator = const xt_event *;
+
+    constexpr event_range(const xt_event *first, const xt_event *last) noexcept
+        : first_(first), last_(last) {}
+
+    iterator begin() const noexcept { return first_; }
+    iterator end() const noexcept { return last_; }
+    std::size_t size() const noexcept { return last_ - first_; }
+    bool empty() const noexcept { return first_ == last_; }
+
+private:
+    const xt_event *first_, *last_;
+};
+
+/**
+ * Range over the events matching "Filter",
+ * see matches() for the filter semantics.
+ * Iterators yield typed_t<Filter>.
+ */
+template <uint32_t Filter>
+class filtered_range {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = std::remove_cv_t<std::remove_reference_t<typed_t<Filter>>>;
+        using reference         = typed_t<Filter>;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = void;
+
+        constexpr iterator() noexcept : curr_(nullptr), last_(nullptr) {}
+        iterator(const xt_event *curr, const xt_event *last) noexcept
+            : curr_(curr), last_(last) { skip(); }
+
+        reference operator*() const noexcept { return reference(*curr_); }
+
+        iterator &operator++() noexcept {
+            ++curr_;
+            skip();
+            return *this;
+        }
+
+        iterator operator++(int) noexcept {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const iterator &other) const noexcept { return curr_ == other.curr_; }
+        bool operator!=(const iterator &other) const noexcept { return curr_ != other.curr_; }
+
+    private:
+        void skip() noexcept {
+            while (curr_ != last_ && !matches(Filter, (curr_->rec).id))
+                ++curr_;
+        }
+
+        const xt_event *curr_, *last_;
+    };
+
+    constexpr filtered_range(const xt_event *first, const xt_event *last) noexcept
+        : first_(first), last_(last) {}
+
+    iterator begin() const noexcept { return iterator(first_, last_); }
+    iterator end() const noexcept { return iterator(last_, last_); }
+
+private:
+    const xt_event *first_, *last_;
+};
+
+/**
+ * Owning wrapper of a parser instance.
+ * Ranges point into the event list and are
+ * valid as long as the parser is alive.
+ */
+class parser {
+public:
+    explicit parser(const std::string &file) : xtp_(xtp_init(file.c_str())) {
+        if (!xtp_)
+            throw std::runtime_error("xentrace: unable to open " + file);
+    }
+
+    // Takes ownership of an existing instance
+    explicit parser(xentrace_parser xtp) noexcept : xtp_(xtp) {}
+
+    parser(const parser &) = delete;
+    parser &operator=(const parser &) = delete;
+
+    parser(parser &&other) noexcept : xtp_(std::exchange(other.xtp_, nullptr)) {}
+    parser &operator=(parser &&other) noexcept {
+        std::swap(xtp_, other.xtp_);
+        return *this;
+    }
+
+    ~parser() {
+        if (xtp_)
+            xtp_free(xtp_);
+    }
+
+    uint32_t execute() { return xtp_execute(xtp_); }
+    uint16_t cpus_count() const { return xtp_cpus_count(xtp_); }
+    uint32_t events_count() const { return xtp_events_count(xtp_); }
+    xentrace_parser handle() const noexcept { return xtp_; }
+
+    // Not available in lazy mode (events are not in a list),
+    // use xtp_read_event() on handle() instead
+    event_range events() const {
+        if (xtp_is_lazy(xtp_))
+            throw std::logic_error("xentrace: event ranges need an eager parser");
+
+        const xt_event *first = xtp_get_event(xtp_, 0);
+        return event_range(first, first ? first + events_count() : first);
+    }
+
+    template <uint32_t Filter>
+    filtered_range<Filter> events() const {
+        event_range all = events();
+        return filtered_range<Filter>(all.begin(), all.end());
+    }
+
+private:
+    xentrace_parser xtp_;
+};
+
+} // namespace xentrace
+
+#endif
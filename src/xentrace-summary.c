@@ -0,0 +1,532 @@
+/**
+ * Timeline summary for XenTrace binary data - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// Xen Project
+#include <trace.h>
+
+#include "xentrace-alloc.h"
+#include "xentrace-lazy.h"
+#include "xentrace-summary.h"
+
+#define SUMMARY_AUTO_LENGTH 65536
+#define SUMMARY_MAX_LEVELS 64
+#define SUMMARY_BUSY_ONE 65535  // Busy fraction of a fully busy hCPU
+#define DOM_SLOTS 4
+
+/**
+ * "Dominant domain" candidates of a bucket,
+ * tracked with the space-saving algorithm:
+ * a newcomer inherits the evicted count, so
+ * counts are upper bounds of the busy cycles,
+ * and a domain left out never ran for more
+ * than the weakest candidate. A table that
+ * is not full (at most DOM_SLOTS domains
+ * ran) is exact.
+ */
+struct __dom_slots {
+    uint16_t id[ DOM_SLOTS ];
+    uint64_t tsc[ DOM_SLOTS ];
+};
+
+/**
+ * Summary pyramid.
+ */
+struct __summary {
+    const xt_allocator *alloc;  // Memory allocator
+
+    uint64_t origin,   // TSC of the first bucket
+            width;     // Level 0 bucket width
+    uint16_t cpus;     // hCPUs count
+    uint8_t levels;    // Levels count
+
+    // Per level bucket lists
+    struct __level {
+        xt_summary *ptr;            // Buckets array
+        uint16_t *busy;             // Busy fractions (length * cpus)
+        struct __dom_slots *slots;  // Dominant domain candidates
+        uint32_t length;            // Array length
+    } level[ SUMMARY_MAX_LEVELS ];
+};
+
+/**
+ * Level 0 busy cycles of the bucket an hCPU is
+ * in, stored as a fraction once it moves on.
+ */
+struct __busy_acc {
+    uint32_t pos;  // Bucket position (UINT32_MAX if none)
+    uint64_t tsc;  // Busy cycles
+};
+
+/**
+ *
+ */
+static uint8_t event_class(uint32_t id) {
+    uint32_t cls = (id >> TRC_CLS_SHIFT) & 0xfff;
+    return cls ? __builtin_ctz(cls) : XTP_SUMMARY_CLASSES;
+}
+
+/**
+ *
+ */
+static void add_dom_tsc(struct __dom_slots *slots, uint16_t dom, uint64_t tsc) {
+    int min = 0;
+
+    for (int i = 0; i < DOM_SLOTS; ++i) {
+        if (slots->tsc[i] && slots->id[i] == dom) {
+            slots->tsc[i] += tsc;
+            return;
+        }
+
+        if (slots->tsc[i] < slots->tsc[min])
+            min = i;
+    }
+
+    // Replace the weakest candidate
+    slots->id[min] = dom;
+    slots->tsc[min] += tsc;
+}
+
+/**
+ *
+ */
+static uint64_t min_dom_tsc(const struct __dom_slots *slots) {
+    uint64_t min = slots->tsc[0];
+    for (int i = 1; i < DOM_SLOTS; ++i) {
+        if (slots->tsc[i] < min)
+            min = slots->tsc[i];
+    }
+
+    return min;
+}
+
+/**
+ *
+ */
+static int find_dom(const struct __dom_slots *slots, uint16_t dom) {
+    for (int i = 0; i < DOM_SLOTS; ++i) {
+        if (slots->tsc[i] && slots->id[i] == dom)
+            return i;
+    }
+
+    return -1;
+}
+
+/**
+ *
+ */
+static void keep_dom_tsc(struct __dom_slots *slots, uint16_t dom, uint64_t tsc) {
+    int min = 0;
+    for (int i = 1; i < DOM_SLOTS; ++i) {
+        if (slots->tsc[i] < slots->tsc[min])
+            min = i;
+    }
+
+    // Keep the strongest candidates only
+    if (tsc > slots->tsc[min]) {
+        slots->id[min] = dom;
+        slots->tsc[min] = tsc;
+    }
+}
+
+/**
+ *
+ */
+static void merge_dom_slots(struct __dom_slots *dst, const struct __dom_slots *left,
+                            const struct __dom_slots *right) {
+    // A domain missing from a child ran there for at most
+    // its weakest count, charge it to keep upper bounds
+    uint64_t left_min = min_dom_tsc(left),
+            right_min = min_dom_tsc(right);
+
+    memset(dst, 0, sizeof(*dst));
+
+    for (int i = 0; i < DOM_SLOTS; ++i) {
+        if (!left->tsc[i])
+            continue;
+
+        int j = find_dom(right, left->id[i]);
+        keep_dom_tsc(dst, left->id[i], left->tsc[i] + (j < 0 ? right_min : right->tsc[j]));
+    }
+
+    for (int j = 0; j < DOM_SLOTS; ++j) {
+        if (right->tsc[j] && find_dom(left, right->id[j]) < 0)
+            keep_dom_tsc(dst, right->id[j], right->tsc[j] + left_min);
+    }
+}
+
+/**
+ *
+ */
+static void pick_dom(xt_summary *bucket, const struct __dom_slots *slots) {
+    bucket->dom = XEN_DOM_IDLE;
+    bucket->dom_tsc = 0;
+
+    for (int i = 0; i < DOM_SLOTS; ++i) {
+        if (slots->tsc[i] > bucket->dom_tsc) {
+            bucket->dom = slots->id[i];
+            bucket->dom_tsc = slots->tsc[i];
+        }
+    }
+}
+
+/**
+ *
+ */
+static void flush_busy(struct __summary *sum, struct __busy_acc *acc, uint16_t cpu) {
+    if (acc->pos == UINT32_MAX)
+        return;
+
+    double busy = (double) acc->tsc / (double) sum->width;
+    sum->level->busy[(uint64_t) acc->pos * sum->cpus + cpu] =
+        (uint16_t) (busy * SUMMARY_BUSY_ONE + 0.5);
+
+    acc->pos = UINT32_MAX;
+    acc->tsc = 0;
+}
+
+/**
+ *
+ */
+static void add_busy(struct __summary *sum, struct __dom_slots *slots, struct __busy_acc *acc,
+                     uint16_t cpu, uint16_t dom, uint64_t from, uint64_t to) {
+    // Split the interval over the buckets it crosses
+    // (the intervals of an hCPU come in TSC order,
+    // so its buckets are never visited again)
+    while (from < to) {
+        uint32_t pos = (from - sum->origin) / sum->width;
+        uint64_t end = sum->origin + (pos + 1) * sum->width;
+        uint64_t tsc = (to < end ? to : end) - from;
+
+        if (acc->pos != pos) {
+            flush_busy(sum, acc, cpu);
+            acc->pos = pos;
+        }
+
+        acc->tsc += tsc;
+        add_dom_tsc(slots + pos, dom, tsc);
+
+        from += tsc;
+    }
+}
+
+/**
+ *
+ */
+static int alloc_level(struct __summary *sum, struct __level *level) {
+    level->ptr = xt_zalloc(sum->alloc, sizeof(*level->ptr) * level->length);
+    level->busy = xt_zalloc(sum->alloc, sizeof(*level->busy) * level->length * sum->cpus);
+    level->slots = xt_zalloc(sum->alloc, sizeof(*level->slots) * level->length);
+
+    return level->ptr && level->busy && level->slots;
+}
+
+/**
+ *
+ */
+static void free_level(struct __summary *sum, struct __level *level) {
+    xt_free(sum->alloc, level->slots, sizeof(*level->slots) * level->length);
+    xt_free(sum->alloc, level->busy, sizeof(*level->busy) * level->length * sum->cpus);
+    xt_free(sum->alloc, level->ptr, sizeof(*level->ptr) * level->length);
+}
+
+/**
+ *
+ */
+static int build_level0(struct __summary *sum, const struct __source *src) {
+    struct __level *level = sum->level;
+    const xt_allocator *alloc = sum->alloc;
+
+    size_t tsc_size = sizeof(uint64_t) * sum->cpus,
+            dom_size  = sizeof(xt_domain) * sum->cpus,
+            acc_size  = sizeof(struct __busy_acc) * sum->cpus;
+
+    uint64_t *prev_tsc = xt_zalloc(alloc, tsc_size);
+    xt_domain *prev_dom = xt_zalloc(alloc, dom_size);
+    struct __busy_acc *acc = xt_zalloc(alloc, acc_size);
+
+    if (!prev_tsc || !prev_dom || !acc) {
+        xt_free(alloc, acc, acc_size);
+        xt_free(alloc, prev_dom, dom_size);
+        xt_free(alloc, prev_tsc, tsc_size);
+        return 0;
+    }
+
+    // Set all hCPUs as not seen yet
+    for (int i = 0; i < sum->cpus; ++i) {
+        prev_dom[i].u32 = (uint32_t) XEN_DOM_DFLT << 16;
+        acc[i].pos = UINT32_MAX;
+    }
+
+    int done = 1;
+    for (uint32_t i = 0; i < src->count; ++i) {
+        xt_event buf;
+        const xt_event *event = source_get(src, i, &buf);
+        if (!event) {
+            done = 0;
+            break;
+        }
+
+        uint64_t tsc = (event->rec).tsc;
+        uint16_t cpu = event->cpu;
+
+        // Count event
+        xt_summary *bucket = level->ptr + (tsc - sum->origin) / sum->width;
+        uint8_t cls = event_class((event->rec).id);
+
+        bucket->events++;
+        if (cls < XTP_SUMMARY_CLASSES)
+            bucket->classes[cls]++;
+
+        // The hCPU ran the previous event's domain
+        // from that event up to this one
+        uint16_t dom = prev_dom[cpu].id;
+        if (dom != XEN_DOM_IDLE && dom != (uint16_t) XEN_DOM_DFLT)
+            add_busy(sum, level->slots, acc + cpu, cpu, dom, prev_tsc[cpu], tsc);
+
+        prev_tsc[cpu] = tsc;
+        prev_dom[cpu] = event->dom;
+    }
+
+    // Store the last bucket of each hCPU
+    for (int i = 0; i < sum->cpus; ++i)
+        flush_busy(sum, acc + i, i);
+
+    // Pick the dominant domain of each bucket
+    for (uint32_t i = 0; i < level->length; ++i) {
+        xt_summary *bucket = level->ptr + i;
+
+        bucket->tsc = sum->origin + i * sum->width;
+        pick_dom(bucket, level->slots + i);
+    }
+
+    xt_free(alloc, acc, acc_size);
+    xt_free(alloc, prev_dom, dom_size);
+    xt_free(alloc, prev_tsc, tsc_size);
+    return done;
+}
+
+/**
+ *
+ */
+static void merge_bucket(xt_summary *dst, const xt_summary *src) {
+    dst->events += src->events;
+    for (int i = 0; i < XTP_SUMMARY_CLASSES; ++i)
+        dst->classes[i] += src->classes[i];
+}
+
+/**
+ *
+ */
+static int build_level(struct __summary *sum, uint8_t lvl) {
+    struct __level *child = sum->level + lvl - 1,
+            *level = sum->level + lvl;
+
+    level->length = (child->length + 1) / 2;
+    if (!alloc_level(sum, level))
+        return 0;
+
+    for (uint32_t i = 0; i < child->length; ++i) {
+        xt_summary *bucket = level->ptr + i / 2;
+        const xt_summary *src = child->ptr + i;
+
+        if (!(i & 1)) {
+            *bucket = *src;
+        } else {
+            merge_bucket(bucket, src);
+        }
+    }
+
+    // Merge the candidates of both children
+    // (the missing last one ran no domain)
+    for (uint32_t i = 0; i < level->length; ++i) {
+        const struct __dom_slots *left = child->slots + i * 2;
+
+        if (i * 2 + 1 < child->length)
+            merge_dom_slots(level->slots + i, left, left + 1);
+        else
+            level->slots[i] = *left;
+
+        pick_dom(level->ptr + i, level->slots + i);
+    }
+
+    // A bucket is as busy as the average of
+    // its children (the missing last one is idle)
+    for (uint32_t i = 0; i < level->length; ++i) {
+        uint16_t *busy = level->busy + (uint64_t) i * sum->cpus;
+        const uint16_t *left = child->busy + (uint64_t) (i * 2) * sum->cpus,
+                *right = i * 2 + 1 < child->length ? left + sum->cpus : NULL;
+
+        for (int j = 0; j < sum->cpus; ++j)
+            busy[j] = (left[j] + (right ? right[j] : 0) + 1) / 2;
+    }
+
+    return 1;
+}
+
+/**
+ *
+ */
+struct __summary *summary_build(const xt_allocator *alloc, const struct __source *src, uint16_t cpus, uint64_t width) {
+    if (!src->count || !cpus)
+        return NULL;
+
+    xt_event first_buf, last_buf;
+    const xt_event *first = source_get(src, 0, &first_buf),
+            *last = source_get(src, src->count - 1, &last_buf);
+    if (!first || !last)
+        return NULL;
+
+    uint64_t origin = (first->rec).tsc,
+            span    = (last->rec).tsc - origin;
+
+    // Auto: smallest power of two giving
+    // at most SUMMARY_AUTO_LENGTH buckets
+    if (!width) {
+        width = 1;
+        while (span / width >= SUMMARY_AUTO_LENGTH)
+            width <<= 1;
+    }
+
+    if (span / width >= UINT32_MAX)
+        return NULL;
+
+    struct __summary *sum = xt_zalloc(alloc, sizeof(*sum));
+    if (!sum)
+        return NULL;
+
+    sum->alloc  = alloc;
+    sum->origin = origin;
+    sum->width  = width;
+    sum->cpus   = cpus;
+    sum->levels = 1;
+
+    // Level 0 is built from the events...
+    struct __level *level = sum->level;
+    level->length = span / width + 1;
+    if (!alloc_level(sum, level) || !build_level0(sum, src)) {
+        summary_free(sum);
+        return NULL;
+    }
+
+    // ...the others by merging pairs of buckets
+    while (sum->level[sum->levels - 1].length > 1) {
+        if (!build_level(sum, sum->levels++)) {
+            summary_free(sum);
+            return NULL;
+        }
+    }
+
+    return sum;
+}
+
+/**
+ *
+ */
+uint8_t summary_levels(const struct __summary *sum) {
+    return sum ? sum->levels : 0;
+}
+
+/**
+ *
+ */
+uint32_t summary_length(const struct __summary *sum, uint8_t lvl) {
+    if (!sum || lvl >= sum->levels)
+        return 0;
+
+    return sum->level[lvl].length;
+}
+
+/**
+ *
+ */
+uint64_t summary_width(const struct __summary *sum, uint8_t lvl) {
+    if (!sum || lvl >= sum->levels)
+        return 0;
+
+    return sum->width << lvl;
+}
+
+/**
+ *
+ */
+xt_summary *summary_get(const struct __summary *sum, uint8_t lvl, uint32_t pos) {
+    if (pos >= summary_length(sum, lvl))
+        return NULL;
+
+    return sum->level[lvl].ptr + pos;
+}
+
+/**
+ *
+ */
+float summary_busy(const struct __summary *sum, uint8_t lvl, uint32_t pos, uint16_t cpu) {
+    if (pos >= summary_length(sum, lvl) || cpu >= sum->cpus)
+        return 0;
+
+    uint16_t busy = sum->level[lvl].busy[(uint64_t) pos * sum->cpus + cpu];
+    return (float) busy / SUMMARY_BUSY_ONE;
+}
+
+/**
+ *
+ */
+uint32_t summary_pos(const struct __summary *sum, uint8_t lvl, uint64_t tsc) {
+    uint32_t length = summary_length(sum, lvl);
+    if (!length || tsc < sum->origin)
+        return 0;
+
+    uint64_t pos = (tsc - sum->origin) / (sum->width << lvl);
+    return pos < length ? pos : length - 1;
+}
+
+/**
+ *
+ */
+uint8_t summary_level_for(const struct __summary *sum, uint64_t from, uint64_t to, uint32_t max) {
+    if (!sum || !max)
+        return 0;
+
+    for (uint8_t lvl = 0; lvl < sum->levels; ++lvl) {
+        uint64_t buckets = summary_pos(sum, lvl, to) - summary_pos(sum, lvl, from) + 1;
+        if (buckets <= max)
+            return lvl;
+    }
+
+    return sum->levels - 1;
+}
+
+/**
+ *
+ */
+void summary_free(struct __summary *sum) {
+    if (!sum)
+        return;
+
+    // Newest first, so that arena bumps can be rolled back
+    for (int i = SUMMARY_MAX_LEVELS; i-- > 0;)
+        free_level(sum, sum->level + i);
+
+    xt_free(sum->alloc, sum, sizeof(*sum));
+}
@@ -0,0 +1,85 @@
+/**
+ * Timeline summary for XenTrace binary data - Copyright (C) 2021
+ * Giuseppe Eletto <peppe.eletto@gmail.com>
+ * Dario Faggioli  <dfaggioli@suse.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef __XTSUMMARY_H
+#define __XTSUMMARY_H
+
+#include <stdint.h>
+
+#include "xentrace-parser.h"
+
+/**
+ * Summary pyramid (internal).
+ */
+struct __summary;
+
+struct __source;
+
+/**
+ * Builds the pyramid of an event source.
+ * A zero width selects it automatically.
+ * Returns NULL on error.
+ */
+struct __summary *summary_build(const xt_allocator *, const struct __source *, uint16_t, uint64_t);
+
+/**
+ * Returns the number of levels.
+ */
+uint8_t summary_levels(const struct __summary *);
+
+/**
+ * Returns the number of buckets of a level.
+ */
+uint32_t summary_length(const struct __summary *, uint8_t);
+
+/**
+ * Returns the bucket width of a level.
+ */
+uint64_t summary_width(const struct __summary *, uint8_t);
+
+/**
+ * Returns the bucket at position X of a level.
+ * Returns NULL on error.
+ */
+xt_summary *summary_get(const struct __summary *, uint8_t, uint32_t);
+
+/**
+ * Returns the busy fraction of an hCPU in a bucket.
+ */
+float summary_busy(const struct __summary *, uint8_t, uint32_t, uint16_t);
+
+/**
+ * Returns the position of the bucket containing a TSC.
+ */
+uint32_t summary_pos(const struct __summary *, uint8_t, uint64_t);
+
+/**
+ * Returns the finest level that covers a TSC
+ * range with at most X buckets.
+ */
+uint8_t summary_level_for(const struct __summary *, uint64_t, uint64_t, uint32_t);
+
+/**
+ * Frees up a pyramid.
+ */
+void summary_free(struct __summary *);
+
+#endif